@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_BATCH_HPP
+#define ADAPTIV_BATCH_HPP
+
+#include <string>
+
+#include <adaptiv/macros.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_PROTOCOL_NAMESPACE_BEGIN
+
+/**
+ * Join serialized NetworkExchanges into a batch
+ * @param exchanges A range of JSON serialized NetworkExchanges
+ */
+template<class Range>
+std::string batch(Range const& exchanges)
+{
+    std::string result = "[";
+    for (auto const& exchange : exchanges) {
+        if (result.size() > 1) result += ',';
+        result += exchange;
+    }
+    return result += ']';
+}
+
+ADAPTIV_PROTOCOL_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_BATCH_HPP
@@ -0,0 +1,513 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_FIELDS_HPP
+#define ADAPTIV_FIELDS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <adaptiv/macros.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_PROTOCOL_NAMESPACE_BEGIN
+
+/**
+ * The layout of field frames: bulk numeric arrays (e.g. the velocity and the
+ * pressure fields of a solution) sent in a binary frame of their own. The
+ * frame is a header, a table of descriptors and the arrays, contiguous and
+ * aligned, so that they are read in place \see FieldReader
+ *
+ *     | Header | Descriptor... | pad | array | pad | array ...
+ *
+ * All values are in the byte order of the sender (the magic number tells).
+ * The header and the descriptors say their own size: later versions only
+ * append members to them (and add fields), which older readers skip.
+ */
+namespace fields {
+
+/// The scalar types of the arrays
+enum class Scalar : std::uint32_t
+{
+    float32 = 1,
+    float64,
+    int32,
+    int64,
+    uint32,
+    uint64
+};
+
+namespace detail {
+template<class T>
+struct scalar { };
+
+#define ADAPTIV_FIELDS_SCALAR(T, Value)                                  \
+template<> struct scalar<T> { static Scalar constexpr value = Value; };
+
+ADAPTIV_FIELDS_SCALAR(float, Scalar::float32)
+ADAPTIV_FIELDS_SCALAR(double, Scalar::float64)
+ADAPTIV_FIELDS_SCALAR(std::int32_t, Scalar::int32)
+ADAPTIV_FIELDS_SCALAR(std::int64_t, Scalar::int64)
+ADAPTIV_FIELDS_SCALAR(std::uint32_t, Scalar::uint32)
+ADAPTIV_FIELDS_SCALAR(std::uint64_t, Scalar::uint64)
+#undef ADAPTIV_FIELDS_SCALAR
+} // namespace detail
+
+/// The Scalar of type \c T
+template<class T>
+Scalar constexpr scalar_v = detail::scalar<T>::value;
+
+/// The bytes of a Scalar, 0 if unknown (i.e. newer than this reader)
+constexpr std::size_t sizeOf(std::uint32_t scalar) noexcept
+{
+    switch (static_cast<Scalar>(scalar)) {
+        case Scalar::float32:
+        case Scalar::int32:
+        case Scalar::uint32: return 4;
+        case Scalar::float64:
+        case Scalar::int64:
+        case Scalar::uint64: return 8;
+    }
+    return 0;
+}
+
+std::uint32_t constexpr magic = 0x4C464441; ///< "ADFL", in little endian
+std::uint16_t constexpr version = 1;
+std::size_t constexpr alignment = 64; ///< Of the arrays, from the frame start
+
+/// The header of a frame (version 1)
+struct Header
+{
+    std::uint32_t magic;
+    std::uint16_t version;
+    std::uint16_t headerSize;     ///< Bytes: the descriptors follow
+    std::uint32_t fields;
+    std::uint32_t descriptorSize; ///< Bytes of each descriptor
+    std::uint64_t size;           ///< Bytes of the frame
+};
+
+/// The descriptor of a field (version 1)
+struct Descriptor
+{
+    char name[24];             ///< Padded with '\0'
+    std::uint32_t scalar;      ///< A Scalar
+    std::uint32_t components;  ///< Per element, e.g. 3 for the velocity
+    std::uint64_t count;       ///< Elements
+    std::uint64_t offset;      ///< Bytes, from the frame start
+    std::uint64_t bytes;       ///< Of the array
+};
+
+static_assert(sizeof(Header) == 24 && sizeof(Descriptor) == 56);
+static_assert(std::is_trivially_copyable_v<Header> &&
+              std::is_trivially_copyable_v<Descriptor>);
+} // namespace fields
+
+/// A read-only array of a field frame: \c count elements of \c components
+template<class T>
+class FieldView
+{
+public:
+    FieldView() = default;
+
+    FieldView(T const* data, std::size_t count, std::size_t components)
+    : data_(data)
+    , count_(count)
+    , components_(components)
+    { }
+
+    T const* data() const noexcept { return data_; }
+    std::size_t count() const noexcept { return count_; }
+    std::size_t components() const noexcept { return components_; }
+
+    /// The number of values, i.e. count() * components()
+    std::size_t size() const noexcept { return count_ * components_; }
+    bool empty() const noexcept { return size() == 0; }
+
+    T const* begin() const noexcept { return data_; }
+    T const* end() const noexcept { return data_ + size(); }
+
+    /// A value, in order (e.g. x0, y0, z0, x1...)
+    T const& operator[](std::size_t index) const noexcept
+    {
+        return data_[index];
+    }
+
+    /// A component of an element (e.g. the y of element 1)
+    T const& operator()(std::size_t element, std::size_t component) const
+    noexcept
+    {
+        return data_[element * components_ + component];
+    }
+
+private:
+    T const* data_ = nullptr;
+    std::size_t count_ = 0;
+    std::size_t components_ = 1;
+};
+
+/// A field of a received frame \see FieldReader
+struct Field
+{
+    std::string_view name;
+    std::uint32_t scalar;   ///< A fields::Scalar, or one unknown to this reader
+    std::size_t components;
+    std::size_t count;
+    char const* data;
+    std::size_t bytes;
+
+    /**
+     * The array, in place
+     * @throw std::runtime_error If its scalar type is not \c T
+     */
+    template<class T>
+    FieldView<T> as() const
+    {
+        if (scalar != static_cast<std::uint32_t>(fields::scalar_v<T>)) {
+            throw std::runtime_error(
+                "[adaptiv::cloud::protocol::Field] " + std::string(name) +
+                " has another scalar type");
+        }
+        return {reinterpret_cast<T const*>(data), count, components};
+    }
+};
+
+/**
+ * Writes a field frame: arrays are copied once, straight into the frame
+ * @code
+ *     protocol::FieldWriter writer;
+ *     writer.add("velocity", velocity, 3).add("pressure", pressure);
+ *     writer.write(buffer);
+ * @endcode
+ * @note The arrays are referenced: they must outlive the writer
+ */
+class FieldWriter
+{
+public:
+    /**
+     * Add a field
+     * @param name Unique, at most 24 characters
+     * @param data The values, in order (e.g. x0, y0, z0, x1...)
+     * @param count The number of elements
+     * @param components The values of each element, at least one
+     * @throw std::invalid_argument If the name is too long or not unique, or
+     * the elements hold no values
+     */
+    template<class T>
+    FieldWriter& add(
+        std::string_view name,
+        T const* data,
+        std::size_t count,
+        std::uint32_t components = 1)
+    {
+        fields::Descriptor descriptor{};
+        if (components == 0) {
+            throw std::invalid_argument(
+                "[adaptiv::cloud::protocol::FieldWriter] no components");
+        }
+        if (name.size() > sizeof(descriptor.name)) {
+            throw std::invalid_argument(
+                "[adaptiv::cloud::protocol::FieldWriter] name too long");
+        }
+        for (auto const& entry : entries_) {
+            if (name == entry.name()) {
+                throw std::invalid_argument(
+                    "[adaptiv::cloud::protocol::FieldWriter] duplicate field");
+            }
+        }
+
+        std::copy(name.begin(), name.end(), descriptor.name);
+        descriptor.scalar = static_cast<std::uint32_t>(fields::scalar_v<T>);
+        descriptor.components = components;
+        descriptor.count = count;
+        descriptor.bytes = count * components * sizeof(T);
+        entries_.push_back({descriptor, data});
+        return *this;
+    }
+
+    /**
+     * Add a field \see add()
+     * @throw std::invalid_argument If \c values are not whole elements
+     */
+    template<class T, class Allocator>
+    FieldWriter& add(
+        std::string_view name,
+        std::vector<T, Allocator> const& values,
+        std::uint32_t components = 1)
+    {
+        if (components == 0 || values.size() % components != 0) {
+            throw std::invalid_argument(
+                "[adaptiv::cloud::protocol::FieldWriter] partial element");
+        }
+        return add(name, values.data(), values.size() / components,
+                   components);
+    }
+
+    /// The bytes of the frame
+    std::size_t size() const noexcept
+    {
+        auto end = tableEnd();
+        for (auto const& entry : entries_) {
+            end = align(end) + entry.descriptor.bytes;
+        }
+        return end;
+    }
+
+    /// Write the frame to \c size() bytes at \c frame
+    void write(char* frame) const
+    {
+        auto const frameSize = size();
+
+        fields::Header const header{
+            fields::magic,
+            fields::version,
+            sizeof(fields::Header),
+            static_cast<std::uint32_t>(entries_.size()),
+            sizeof(fields::Descriptor),
+            frameSize
+        };
+        std::memcpy(frame, &header, sizeof(header));
+
+        auto table = frame + sizeof(header);
+        auto end = tableEnd();
+        for (auto const& entry : entries_) {
+            auto const offset = align(end);
+            std::memset(frame + end, 0, offset - end);
+
+            auto descriptor = entry.descriptor;
+            descriptor.offset = offset;
+            std::memcpy(table, &descriptor, sizeof(descriptor));
+            table += sizeof(descriptor);
+
+            std::memcpy(frame + offset, entry.data, descriptor.bytes);
+            end = offset + descriptor.bytes;
+        }
+    }
+
+    /// Write the frame to a contiguous DynamicBuffer (e.g. flat_buffer)
+    template<class DynamicBuffer>
+    void write(DynamicBuffer& buffer) const
+    {
+        auto const frameSize = size();
+        write(static_cast<char*>(buffer.prepare(frameSize).data()));
+        buffer.commit(frameSize);
+    }
+
+    /// The frame
+    std::string str() const
+    {
+        std::string frame(size(), '\0');
+        write(frame.data());
+        return frame;
+    }
+
+private:
+    struct Entry
+    {
+        fields::Descriptor descriptor;
+        void const* data;
+
+        std::string_view name() const noexcept
+        {
+            auto const& name = descriptor.name;
+            return {name, static_cast<std::size_t>(
+                std::find(name, name + sizeof(name), '\0') - name)};
+        }
+    };
+
+    static std::size_t align(std::size_t offset) noexcept
+    {
+        return (offset + fields::alignment - 1) / fields::alignment *
+            fields::alignment;
+    }
+
+    /// The end of the descriptors
+    std::size_t tableEnd() const noexcept
+    {
+        return sizeof(fields::Header) +
+            entries_.size() * sizeof(fields::Descriptor);
+    }
+
+    std::vector<Entry> entries_;
+};
+
+/**
+ * Reads a field frame in place: its arrays are views of the received data,
+ * with no per-value decoding and no allocation. Fields, and members of the
+ * header and the descriptors, newer than this reader are skipped.
+ * @code
+ *     protocol::FieldReader reader(frame);
+ *     if (auto velocity = reader.get<double>("velocity")) {
+ *         auto u = (*velocity)(cell, 0);
+ *     }
+ * @endcode
+ * @note The frame must outlive the reader (and its views)
+ * @note Frames that are not 8 byte aligned (e.g. a string_view into the
+ * middle of a buffer) are copied once, to an aligned buffer of the reader
+ */
+class FieldReader
+{
+public:
+    /// Whether a frame is a field frame, rather than binary NetworkExchanges
+    static bool matches(std::string_view frame) noexcept
+    {
+        std::uint32_t value = 0;
+        if (frame.size() < sizeof(value)) return false;
+        std::memcpy(&value, frame.data(), sizeof(value));
+        return value == fields::magic || value == swapped(fields::magic);
+    }
+
+    /**
+     * Check a received frame
+     * @throw std::runtime_error If the frame is not a field frame, is
+     * truncated, or is in another byte order
+     */
+    explicit FieldReader(std::string_view frame)
+    {
+        if (frame.size() < sizeof(fields::Header)) fail("truncated frame");
+
+        if (reinterpret_cast<std::uintptr_t>(frame.data()) %
+            alignof(std::uint64_t) != 0) {
+            copy_.resize((frame.size() + sizeof(std::uint64_t) - 1) /
+                         sizeof(std::uint64_t));
+            std::memcpy(copy_.data(), frame.data(), frame.size());
+            frame = {reinterpret_cast<char const*>(copy_.data()),
+                     frame.size()};
+        }
+
+        fields::Header header{};
+        std::memcpy(&header, frame.data(), sizeof(header));
+        if (header.magic != fields::magic) {
+            fail(header.magic == swapped(fields::magic) ?
+                 "frame in another byte order" : "not a field frame");
+        }
+        if (header.headerSize < sizeof(fields::Header) ||
+            header.descriptorSize < sizeof(fields::Descriptor)) {
+            fail("malformed header");
+        }
+        if (header.size > frame.size() ||
+            header.headerSize + std::uint64_t(header.fields) *
+            header.descriptorSize > header.size) {
+            fail("truncated frame");
+        }
+
+        frame_ = frame.data();
+        version_ = header.version;
+        headerSize_ = header.headerSize;
+        descriptorSize_ = header.descriptorSize;
+        fields_ = header.fields;
+
+        // Every array lies within the frame, aligned for its scalar type
+        for (std::size_t i = 0; i < fields_; ++i) {
+            auto const field = descriptor(i);
+            if (field.offset > header.size ||
+                field.bytes > header.size - field.offset) {
+                fail("truncated frame");
+            }
+
+            auto const scalarSize = fields::sizeOf(field.scalar);
+            if (scalarSize == 0) continue;
+            if (field.offset % scalarSize != 0 || field.components == 0 ||
+                field.bytes % (scalarSize * field.components) != 0 ||
+                field.bytes / (scalarSize * field.components) != field.count) {
+                fail("malformed field");
+            }
+        }
+    }
+
+    // The views may point to this object's copy
+    FieldReader(FieldReader const&) = delete;
+    FieldReader& operator=(FieldReader const&) = delete;
+
+    /// The version of the writer
+    std::uint16_t version() const noexcept { return version_; }
+
+    /// The number of fields
+    std::size_t size() const noexcept { return fields_; }
+
+    /// A field, in the order of the frame
+    Field operator[](std::size_t index) const noexcept
+    {
+        auto const field = descriptor(index);
+        auto const& name = field.name;
+        return {
+            {frame_ + headerSize_ + index * descriptorSize_,
+             static_cast<std::size_t>(
+                 std::find(name, name + sizeof(name), '\0') - name)},
+            field.scalar,
+            field.components,
+            static_cast<std::size_t>(field.count),
+            frame_ + field.offset,
+            static_cast<std::size_t>(field.bytes)
+        };
+    }
+
+    /// The field called \c name, if any
+    std::optional<Field> find(std::string_view name) const noexcept
+    {
+        for (std::size_t i = 0; i < fields_; ++i) {
+            auto field = (*this)[i];
+            if (field.name == name) return field;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * The array of the field called \c name, if any
+     * @throw std::runtime_error If its scalar type is not \c T
+     */
+    template<class T>
+    std::optional<FieldView<T>> get(std::string_view name) const
+    {
+        auto const field = find(name);
+        if (!field) return std::nullopt;
+        return field->as<T>();
+    }
+
+private:
+    [[noreturn]] static void fail(char const* what)
+    {
+        throw std::runtime_error(
+            std::string("[adaptiv::cloud::protocol::FieldReader] ") + what);
+    }
+
+    static constexpr std::uint32_t swapped(std::uint32_t value) noexcept
+    {
+        return (value >> 24) | ((value >> 8) & 0xFF00) |
+            ((value << 8) & 0xFF0000) | (value << 24);
+    }
+
+    /// The known members of a descriptor
+    fields::Descriptor descriptor(std::size_t index) const noexcept
+    {
+        fields::Descriptor descriptor{};
+        std::memcpy(&descriptor, frame_ + headerSize_ + index * descriptorSize_,
+                    sizeof(descriptor));
+        return descriptor;
+    }
+
+    char const* frame_ = nullptr;
+    std::uint16_t version_ = 0;
+    std::size_t headerSize_ = 0;
+    std::size_t descriptorSize_ = 0;
+    std::size_t fields_ = 0;
+    std::vector<std::uint64_t> copy_; ///< Of a misaligned frame
+};
+
+ADAPTIV_PROTOCOL_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_FIELDS_HPP
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_PROTOCOL_FORMAT_HPP
+#define ADAPTIV_PROTOCOL_FORMAT_HPP
+
+#include <string_view>
+#include <optional>
+#include <array>
+
+#include <adaptiv/macros.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_PROTOCOL_NAMESPACE_BEGIN
+
+/// The wire format of a serialized NetworkExchange
+enum class Format
+{
+    json,   ///< Text (cereal's JSON archive), e.g. for browsers
+    binary  ///< cereal's portable binary archive, for native clients
+};
+
+/// The layout of the JSON format
+struct JSONStyle
+{
+    /// Without whitespace, i.e. not pretty-printed
+    bool compact = false;
+
+    /**
+     * Significant digits of floating point numbers, or zero for the
+     * shortest representation that reads back exactly
+     * @note Only for compact output: pretty output keeps cereal's defaults
+     */
+    int precision = 0;
+};
+
+/**
+ * The WebSocket subprotocol (i.e. Sec-WebSocket-Protocol) naming a format
+ * @note A WebSocket session negotiates its format during the handshake
+ */
+inline std::string_view subprotocol(Format format) noexcept
+{
+    switch (format) {
+    case Format::binary: return "adaptiv.binary";
+    case Format::json:   break;
+    }
+    return "adaptiv.json";
+}
+
+/**
+ * Choose the format from the subprotocols offered by a client
+ * @param offer The Sec-WebSocket-Protocol field: a comma separated list of
+ * subprotocols, in order of preference
+ * @return The first known format, if any
+ */
+inline std::optional<Format> negotiate(std::string_view offer)
+{
+    std::array<Format, 2> constexpr known{Format::json, Format::binary};
+
+    while (!offer.empty()) {
+        auto const comma = offer.find(',');
+        auto item = offer.substr(0, comma);
+        offer.remove_prefix(comma == std::string_view::npos ?
+                                offer.size() : comma + 1);
+
+        // Trim the optional whitespace around each item
+        auto const first = item.find_first_not_of(" \t");
+        if (first == std::string_view::npos) continue;
+        item = item.substr(first, item.find_last_not_of(" \t") - first + 1);
+
+        for (auto format : known) {
+            if (item == subprotocol(format)) return format;
+        }
+    }
+    return std::nullopt;
+}
+
+ADAPTIV_PROTOCOL_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_PROTOCOL_FORMAT_HPP
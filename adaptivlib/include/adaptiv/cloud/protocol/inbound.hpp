@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_INBOUND_HPP
+#define ADAPTIV_INBOUND_HPP
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <exception>
+
+#include <adaptiv/cloud/protocol/protocol.hpp>
+#include <adaptiv/cloud/protocol/schema.hpp>
+#include <adaptiv/serialization/memory_stream.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_PROTOCOL_NAMESPACE_BEGIN
+
+/**
+ * A received frame of NetworkExchanges: a single one or a batch, read in
+ * order. The frame is parsed once: the header of each NetworkExchange is
+ * peeked from that parse, and the NetworkExchange is then reconstructed
+ * from it too (i.e. from the JSON document, or straight from the binary
+ * data), without copying the frame.
+ * @code
+ *     protocol::Inbound inbound(buffer, format);
+ *     while (!inbound.done()) {
+ *         if (inbound.header().target == "solve") {
+ *             auto request = inbound.read<Request<RANSRequest>>();
+ *         } else {
+ *             inbound.skip();
+ *         }
+ *     }
+ * @endcode
+ * @note The frame must outlive the Inbound
+ */
+class Inbound
+{
+public:
+    /**
+     * Parse a received frame, read-only
+     * @param frame The received data
+     * @param format The wire format of \c frame
+     */
+    Inbound(std::string_view frame, Format format)
+    : format_(format)
+    {
+        if (format_ == Format::json) {
+            document_.Parse(frame.data(), frame.size());
+            start();
+        } else {
+            stream_.emplace(frame.data(), frame.size());
+            peek();
+        }
+    }
+
+    /**
+     * Parse a received frame held by a contiguous DynamicBuffer (e.g.
+     * beast::flat_buffer). JSON is parsed in situ: the strings of the
+     * document point into the buffer, which is modified
+     * @param buffer The received data: its readable bytes
+     * @param format The wire format of the data
+     */
+    template<class DynamicBuffer, std::enable_if_t<
+        !std::is_convertible_v<DynamicBuffer&, std::string_view>, int> = 0>
+    Inbound(DynamicBuffer& buffer, Format format)
+    : format_(format)
+    {
+        auto const size = buffer.size();
+
+        // The in situ parser needs a terminator, right past the data
+        buffer.prepare(1);
+        auto data = static_cast<char*>(buffer.data().data());
+        data[size] = '\0';
+
+        if (format_ == Format::json) {
+            document_.ParseInsitu(data);
+            start();
+        } else {
+            stream_.emplace(data, size);
+            peek();
+        }
+    }
+
+    // The stream reads from this object's members
+    Inbound(Inbound const&) = delete;
+    Inbound& operator=(Inbound const&) = delete;
+
+    /// The frame is a JSON array of NetworkExchanges
+    bool isBatch() const noexcept { return isBatch_; }
+
+    /// All the NetworkExchanges of the frame have been read (or skipped)
+    bool done() const noexcept
+    {
+        if (format_ == Format::json) return item_ == end_;
+        return isBroken_ ||
+            stream_->rdbuf()->sgetc() == std::istream::traits_type::eof();
+    }
+
+    /**
+     * The header of the next NetworkExchange, with an empty target if the
+     * data is not a NetworkExchange
+     */
+    Header const& header() const noexcept { return header_; }
+
+    /**
+     * Reconstruct the next NetworkExchange and move on to the one after it
+     * @tparam Exchange The type of NetworkExchange, according to the target
+     * (e.g. Request<RANSRequest>)
+     * @throw std::exception If the data does not match \c Exchange. For the
+     * binary format, the rest of the frame is then lost (done() is true):
+     * the NetworkExchanges after it cannot be located
+     */
+    template<class Exchange>
+    Exchange read()
+    {
+        if (format_ == Format::json) {
+            auto const& item = *item_;
+            next();
+            return Exchange(item);
+        }
+
+        try {
+            Exchange exchange(*stream_, Format::binary);
+            peek();
+            return exchange;
+        } catch (std::exception const&) {
+            isBroken_ = true;
+            throw;
+        }
+    }
+
+    /**
+     * Validate the next NetworkExchange against the schema of its type,
+     * without reconstructing it (i.e. a walk of the parsed JSON, which throws
+     * nothing) \see protocol::validate()
+     * @tparam Exchange The type of NetworkExchange, according to the target
+     * @return An empty string if it is valid, otherwise the violated keyword
+     * and where. Binary NetworkExchanges have no schema: always valid
+     */
+    template<class Exchange>
+    std::string check() const
+    {
+        if (format_ != Format::json || item_ == end_) return {};
+        return protocol::validate<Exchange>(*item_);
+    }
+
+    /**
+     * Move on to the next NetworkExchange without reconstructing the current
+     * one (e.g. its target is unknown)
+     * @return False if the rest of the frame is lost: binary NetworkExchanges
+     * can only be located by reading them
+     */
+    bool skip() noexcept
+    {
+        if (format_ == Format::json) {
+            next();
+            return true;
+        }
+
+        isBroken_ = true;
+        return false;
+    }
+
+private:
+    /// Iterate the items of a batch, or the single item of the frame
+    void start()
+    {
+        if (document_.IsArray()) {
+            isBatch_ = true;
+            item_ = document_.Begin();
+            end_ = document_.End();
+        } else {
+            // A parse error leaves a null document: not a NetworkExchange
+            item_ = &document_;
+            end_ = item_ + 1;
+        }
+        if (item_ != end_) header_ = protocol::header(*item_);
+    }
+
+    /// Move on to the next JSON item
+    void next()
+    {
+        ++item_;
+        header_ = item_ != end_ ? protocol::header(*item_) : Header{};
+    }
+
+    /// Peek the header of the next binary NetworkExchange
+    void peek()
+    {
+        header_ = done() ? Header{} : protocol::header(*stream_);
+    }
+
+    Format const format_;
+    Header header_;
+
+    // [json] ------------------------------------------------------------ begin
+    rapidjson::Document document_;
+    rapidjson::Value const* item_ = nullptr;
+    rapidjson::Value const* end_ = nullptr;
+    bool isBatch_ = false;
+    // [json] -------------------------------------------------------------- end
+
+    // [binary] ---------------------------------------------------------- begin
+    std::optional<serialization::MemoryInputStream> stream_;
+    bool isBroken_ = false; ///< A NetworkExchange could not be read
+    // [binary] ------------------------------------------------------------ end
+};
+
+ADAPTIV_PROTOCOL_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_INBOUND_HPP
@@ -23,6 +23,17 @@ ADAPTIV_NAMESPACE_BEGIN
 ADAPTIV_CLOUD_NAMESPACE_BEGIN
 ADAPTIV_PROTOCOL_NAMESPACE_BEGIN
 
+/**
+ * A RANS request: starts the solver, or joins the ongoing solve. It takes
+ * no parameters (the case is set up on the server)
+ */
+struct RANSRequest
+{
+    /// Make the request serializable
+    template<class Archive>
+    void serialize(Archive&) { }
+};
+
 /// A RANS response
 struct RANSResponse
 {
@@ -8,6 +8,7 @@
 #ifndef ADAPTIV_SERVER_STATUS_HPP
 #define ADAPTIV_SERVER_STATUS_HPP
 
+#include <iomanip>
 #include <iostream>
 
 
@@ -21,6 +22,18 @@ ADAPTIV_NAMESPACE_BEGIN
 ADAPTIV_CLOUD_NAMESPACE_BEGIN
 ADAPTIV_PROTOCOL_NAMESPACE_BEGIN
 
+namespace requests {
+
+/// Asks for the server status (i.e. a ping), it takes no parameters
+struct ServerStatus
+{
+    /// Make the request serializable
+    template<class Archive>
+    void serialize(Archive&) { }
+};
+
+} // namespace requests
+
 namespace responses {
 
 /// Indicates the server status, also used as a welcome message to clients
@@ -9,7 +9,9 @@
 #define ADAPTIV_NETWORK_EXCHANGE_HPP
 
 #include <type_traits>
+#include <cstdint>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <iostream>
 #include <string>
@@ -18,7 +20,15 @@
 #include <adaptiv/macros.hpp>
 #include <adaptiv/serialization/external/cereal/details/traits.hpp>
 #include <adaptiv/serialization/external/cereal/archives/json.hpp>
+#include <adaptiv/serialization/external/cereal/archives/portable_binary.hpp>
+#include <adaptiv/serialization/external/cereal/types/string.hpp>
 #include <adaptiv/serialization/macros.hpp>
+#include <adaptiv/serialization/bounded_binary.hpp>
+#include <adaptiv/serialization/compact_json.hpp>
+#include <adaptiv/serialization/direct_json.hpp>
+#include <adaptiv/serialization/json_value.hpp>
+#include <adaptiv/serialization/memory_stream.hpp>
+#include <adaptiv/cloud/protocol/format.hpp>
 
 ADAPTIV_NAMESPACE_BEGIN
 ADAPTIV_CLOUD_NAMESPACE_BEGIN
@@ -39,6 +49,15 @@ static_assert(                                                      \
     "[adaptiv::cloud::protocol::NetworkExchange] "                  \
     "a request/response NetworkMessage must be JSON serializable")  \
 
+/// Correlates the responses to a request over a shared connection
+using id_t = std::uint64_t;
+
+/**
+ * The id of exchanges that answer no request in particular (e.g. welcome or
+ * broadcast messages)
+ */
+id_t constexpr unsolicited = 0;
+
 /**
  * The base class for an adaptiv client-server network exchange
  * @tparam NetworkMessage A JSON serializable type holding the message to
@@ -66,41 +85,88 @@ public:
      * Create a NetworkExchange from data to be sent
      * @param target The target of the exchange
      * @param message The message sent to or received from the \c target
+     * @param id Chosen by the client for a request, copied to its responses
      */
-    NetworkExchange(std::string target, NetworkMessage const& message)
+    NetworkExchange(
+        std::string target,
+        NetworkMessage message,
+        id_t id = unsolicited)
     : target_(std::move(target))
-    , message_(message)
+    , id_(id)
+    , message_(std::move(message))
     {
         ADAPTIV_ASSERT_IS_JSON_SERIALIZABLE(NetworkMessage);
     }
 
     /// Reconstruct a NetworkExchange from received data
-    explicit NetworkExchange(std::string const& request)
+    explicit NetworkExchange(
+        std::string const& request,
+        Format format = Format::json)
     {
         ADAPTIV_ASSERT_IS_JSON_SERIALIZABLE(NetworkMessage);
-        NetworkExchange temp("", NetworkMessage{});
-        {
-            // todo: non-copying stream?
-            std::istringstream in(request);
 
-            // Load the data into temp
-            cereal::JSONInputArchive iarchive(in);
-            iarchive(temp);
-        }
-        *this = temp;
+        serialization::MemoryInputStream in(request.data(), request.size());
+        load(in, format);
     }
 
-    /// Make the NetworkExchange serializable
+    /**
+     * Reconstruct the next NetworkExchange of a stream of received data
+     * @note Binary batches hold several NetworkExchanges back to back
+     */
+    NetworkExchange(std::istream& in, Format format)
+    {
+        ADAPTIV_ASSERT_IS_JSON_SERIALIZABLE(NetworkMessage);
+        load(in, format);
+    }
+
+    /**
+     * Reconstruct a NetworkExchange from received data already parsed, e.g.
+     * while peeking its header or splitting a batch
+     * @param document A parsed JSON NetworkExchange
+     */
+    explicit NetworkExchange(CEREAL_RAPIDJSON_NAMESPACE::Value const& document)
+    {
+        ADAPTIV_ASSERT_IS_JSON_SERIALIZABLE(NetworkMessage);
+
+        serialization::JSONValueInputArchive iarchive(document);
+        iarchive(*this);
+    }
+
+    /**
+     * Make the NetworkExchange serializable
+     * @note The target comes first, and then the id, so that header() can
+     * peek them without knowing the NetworkMessage type
+     */
     template<class Archive>
     void serialize(Archive& archive)
     {
         archive(
         cereal::make_nvp("target", target_),
+        cereal::make_nvp("id", id_),
         cereal::make_nvp("message", message_));
     }
 
+    /// The same members, for serialization::DirectJSONWriter
+    template<class Visitor>
+    void visitMembers(Visitor& visitor) const
+    {
+        visitor("target", target_);
+        visitor("id", id_);
+        visitor("message", message_);
+    }
+
+    using serialized_members_t = std::tuple<std::string, id_t, NetworkMessage>;
+
     std::string const& target()  const noexcept { return target_; }
-    NetworkMessage     const& message() const noexcept { return message_; };
+    id_t                  id()  const noexcept { return id_; }
+    NetworkMessage     const& message() const& noexcept { return message_; };
+
+    /// Take the message out of a NetworkExchange that is no longer needed
+    NetworkMessage message() && noexcept(
+        std::is_nothrow_move_constructible_v<NetworkMessage>)
+    {
+        return std::move(message_);
+    }
 
 protected:
     /** The serialized NetworkExchange in JSON format
@@ -108,16 +174,85 @@ protected:
      */
     std::string json(std::string const& exchangeType)
     {
+        return encode(exchangeType, Format::json);
+    }
+
+    /** The serialized NetworkExchange
+     * @param exchangeType The type of the exchange (i.e. "request"/"response")
+     * @param format The wire format
+     * @param style The layout of the JSON format
+     */
+    std::string encode(
+        std::string const& exchangeType,
+        Format format,
+        JSONStyle const& style = {})
+    {
+        if constexpr (isDirect) {
+            if (format == Format::json && style.compact) {
+                std::string json;
+                writeJSON(json, exchangeType, style.precision);
+                return json;
+            }
+        }
+
         std::ostringstream out;
-        {
+        if (format == Format::binary) {
+            // The exchange type first, so that target() can peek past it
+            cereal::PortableBinaryOutputArchive oarchive(out);
+            oarchive(exchangeType, *this);
+        } else if (style.compact) {
+            serialization::CompactJSONOutputArchive oarchive(
+                out, style.precision);
+            oarchive(cereal::make_nvp(exchangeType, *this));
+        } else {
             cereal::JSONOutputArchive oarchive(out);
             oarchive(cereal::make_nvp(exchangeType, *this));
         }
         return out.str();
     }
 
+    /// The NetworkMessage is written without cereal in compact JSON
+    static bool constexpr isDirect =
+        serialization::traits::is_direct_json_serializable_v<NetworkMessage>;
+
+    /**
+     * Append the NetworkExchange in compact JSON to a buffer, without
+     * iostreams nor cereal \see serialization::DirectJSONWriter
+     * @param buffer A std::string or a contiguous DynamicBuffer
+     * @param exchangeType The type of the exchange (i.e. "request"/"response")
+     * @param precision The significant digits of floating point numbers
+     */
+    template<class Buffer>
+    void writeJSON(
+        Buffer& buffer,
+        std::string const& exchangeType,
+        int precision) const
+    {
+        static_assert(isDirect,
+            "[adaptiv::cloud::protocol::NetworkExchange] the NetworkMessage "
+            "must be made serializable with ADAPTIV_SERIALIZE");
+
+        serialization::DirectJSONWriter writer(buffer, precision);
+        writer.write(exchangeType, *this);
+    }
+
     std::string target_;
+    id_t id_ = unsolicited;
     NetworkMessage message_;
+
+private:
+    /// Load the NetworkExchange from a stream of received data, in place
+    void load(std::istream& in, Format format)
+    {
+        if (format == Format::binary) {
+            serialization::BoundedBinaryInputArchive iarchive(in);
+            std::string exchangeType;
+            iarchive(exchangeType, *this);
+        } else {
+            cereal::JSONInputArchive iarchive(in);
+            iarchive(*this);
+        }
+    }
 };
 
 ADAPTIV_PROTOCOL_NAMESPACE_END
@@ -8,41 +8,119 @@
 #ifndef ADAPTIV_PROTOCOL_HPP
 #define ADAPTIV_PROTOCOL_HPP
 
+#include <string>
+#include <sstream>
+#include <exception>
+#include <istream>
+
+#include <adaptiv/cloud/protocol/format.hpp>
 #include <adaptiv/cloud/protocol/request.hpp>
 #include <adaptiv/cloud/protocol/response.hpp>
+#include <adaptiv/cloud/protocol/batch.hpp>
 
 ADAPTIV_NAMESPACE_BEGIN
 ADAPTIV_CLOUD_NAMESPACE_BEGIN
 ADAPTIV_PROTOCOL_NAMESPACE_BEGIN
 
-/** Get the target of a serialized NetworkExchange
- * This function is used to peek the serialized NetworkExchange, so that a
- * NetworkExchange object can be reconstructed with the appropriate Message
- * type.
- * @param networkExchange A JSON serialized NetworkExchange
+/// What routes a serialized NetworkExchange, peeked before reconstructing it
+struct Header
+{
+    std::string target;     ///< Empty if the data is not a NetworkExchange
+    id_t id = unsolicited;  ///< Matches a response to its request
+};
+
+/** Get the header of a parsed JSON NetworkExchange
+ * @param document A JSON serialized NetworkExchange, already parsed
  */
-inline std::string target(std::string const& networkExchange)
+inline Header header(rapidjson::Value const& document)
 {
-    rapidjson::Document document;
+    if (!document.IsObject()) return {};
+
+    // Handle a request or a response
+    auto exchange = document.FindMember("request");
+    if (exchange == document.MemberEnd()) {
+        exchange = document.FindMember("response");
+    }
+    if (exchange == document.MemberEnd() || !exchange->value.IsObject()) {
+        return {};
+    }
+
+    auto const& value = exchange->value;
+    if (!value.HasMember("target") || !value["target"].IsString()) return {};
 
-    document.Parse(networkExchange.c_str());
+    Header header;
+    header.target = value["target"].GetString();
+    if (value.HasMember("id") && value["id"].IsUint64()) {
+        header.id = value["id"].GetUint64();
+    }
+    return header;
+}
 
-    if (document.HasMember("request")) {
-        // Handle a request
-        if (!document["request"].HasMember("target")) return "";
-        if (!document["request"]["target"].IsString()) return "";
+/** Get the header of the next NetworkExchange of a binary stream
+ * @param in A stream of binary serialized NetworkExchanges, e.g. a batch
+ * @note The stream is left where it was, so that the NetworkExchange can
+ * then be reconstructed from it
+ */
+inline Header header(std::istream& in)
+{
+    Header header;
+    auto const position = in.tellg();
 
-        return document["request"]["target"].GetString();
-    } else if (document.HasMember("response")) {
-        // Handle a response
-        if (!document["response"].HasMember("target")) return "";
-        if (!document["response"]["target"].IsString()) return "";
+    // The exchange type (i.e. "request"/"response"), the target, the id
+    try {
+        serialization::BoundedBinaryInputArchive iarchive(in);
 
-        return document["response"]["target"].GetString();
+        std::string exchangeType;
+        iarchive(exchangeType, header.target, header.id);
+    } catch (std::exception const&) {
+        // We didn't get a networkExchange
+        header = {};
     }
 
-    // We didn't get a networkExchange
-    return ""; //
+    in.clear();
+    in.seekg(position);
+    return header;
+}
+
+/** Get the header of a serialized NetworkExchange
+ * This function is used to peek the serialized NetworkExchange, so that a
+ * NetworkExchange object can be reconstructed with the appropriate Message
+ * type, and a response can be matched to its request.
+ * @param networkExchange A serialized NetworkExchange
+ * @param format The wire format of \c networkExchange
+ */
+inline Header header(
+    std::string const& networkExchange,
+    Format format = Format::json)
+{
+    if (format == Format::binary) {
+        std::istringstream in(networkExchange);
+        return header(in);
+    }
+
+    rapidjson::Document document;
+    document.Parse(networkExchange.c_str(), networkExchange.size());
+    if (document.HasParseError()) return {};
+
+    return header(document);
+}
+
+/** Get the target of a serialized NetworkExchange
+ * @param networkExchange A JSON serialized NetworkExchange
+ * @return The target, or an empty string if we didn't get a NetworkExchange
+ */
+inline std::string target(std::string const& networkExchange)
+{
+    return header(networkExchange).target;
+}
+
+/** Get the target of a serialized NetworkExchange
+ * @param networkExchange A serialized NetworkExchange
+ * @param format The wire format of \c networkExchange
+ */
+inline std::string target(std::string const& networkExchange, Format format)
+{
+    return header(networkExchange, format).target;
 }
 
 ADAPTIV_PROTOCOL_NAMESPACE_END
@@ -41,14 +41,32 @@ public:
      * Create a Request from data to be sent
      * @param target The target of the request
      * @param message The message (i.e. params) sent to the request \c target
+     * @param id Identifies the responses to this Request, among the ones
+     * to other outstanding requests on the same connection
      */
-    Request(std::string const& target, NetworkMessage const& message)
-    : NetworkExchange<NetworkMessage>::NetworkExchange(target, message)
+    Request(
+        std::string const& target,
+        NetworkMessage message,
+        id_t id = unsolicited)
+    : NetworkExchange<NetworkMessage>::NetworkExchange(
+        target, std::move(message), id)
     { /* Invoke the base constructor to enable template type deduction */ }
 
     /// Reconstruct a Request from received data
-    explicit Request(std::string const& request)
-    : NetworkExchange<NetworkMessage>::NetworkExchange(request)
+    explicit Request(
+        std::string const& request,
+        Format format = Format::json)
+    : NetworkExchange<NetworkMessage>::NetworkExchange(request, format)
+    { }
+
+    /// Reconstruct the next Request of a stream of received data
+    Request(std::istream& in, Format format)
+    : NetworkExchange<NetworkMessage>::NetworkExchange(in, format)
+    { }
+
+    /// Reconstruct a Request from received data already parsed
+    explicit Request(CEREAL_RAPIDJSON_NAMESPACE::Value const& document)
+    : NetworkExchange<NetworkMessage>::NetworkExchange(document)
     { }
 
     /// Make the Request serializable
@@ -59,9 +77,41 @@ public:
     }
 
     /// The serialized Request in JSON format
-    std::string json()
+    std::string json(JSONStyle const& style = {})
+    {
+        return encode(Format::json, style);
+    }
+
+    /**
+     * Append the Request in compact JSON to a buffer, e.g. a beast::flat_buffer
+     * about to be written, without iostreams nor cereal
+     * @param buffer A std::string or a contiguous DynamicBuffer
+     * @param precision The significant digits of floating point numbers, or
+     * zero for the shortest representation that reads back exactly
+     * @note The NetworkMessage must be made serializable with ADAPTIV_SERIALIZE
+     */
+    template<class Buffer>
+    void appendJSON(Buffer& buffer, int precision = 0) const
+    {
+        NetworkExchange<NetworkMessage>::writeJSON(
+            buffer, "request", precision);
+    }
+
+    /// The serialized Request in binary format (cereal's portable binary)
+    std::string binary()
+    {
+        return encode(Format::binary);
+    }
+
+    /**
+     * The serialized Request
+     * @param format The wire format
+     * @param style The layout of the JSON format (e.g. compact)
+     */
+    std::string encode(Format format, JSONStyle const& style = {})
     {
-        return NetworkExchange<NetworkMessage>::json("request");
+        return NetworkExchange<NetworkMessage>::encode(
+            "request", format, style);
     }
 };
 
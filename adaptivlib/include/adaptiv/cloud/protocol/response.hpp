@@ -64,17 +64,38 @@ public:
      * Create a Response from data to be sent
      * @param target The target of the response
      * @param message The message (i.e. results) sent by the response \c target
+     * @param id The id of the request answered, if any
      */
-    Response(std::string const& target, NetworkMessage const& message)
-    : NetworkExchange<NetworkMessage>::NetworkExchange(target, message)
+    Response(
+        std::string const& target,
+        NetworkMessage message,
+        id_t id = unsolicited)
+    : NetworkExchange<NetworkMessage>::NetworkExchange(
+        target, std::move(message), id)
     {
         /* Invoke the base constructor to enable template type deduction */
         ADAPTIV_ASSERT_HAS_RESPONSE_ERROR(NetworkMessage);
     }
 
     /// Reconstruct a Response from received data
-    explicit Response(std::string const& request)
-    : NetworkExchange<NetworkMessage>::NetworkExchange(request)
+    explicit Response(
+        std::string const& request,
+        Format format = Format::json)
+    : NetworkExchange<NetworkMessage>::NetworkExchange(request, format)
+    {
+        ADAPTIV_ASSERT_HAS_RESPONSE_ERROR(NetworkMessage);
+    }
+
+    /// Reconstruct the next Response of a stream of received data
+    Response(std::istream& in, Format format)
+    : NetworkExchange<NetworkMessage>::NetworkExchange(in, format)
+    {
+        ADAPTIV_ASSERT_HAS_RESPONSE_ERROR(NetworkMessage);
+    }
+
+    /// Reconstruct a Response from received data already parsed
+    explicit Response(CEREAL_RAPIDJSON_NAMESPACE::Value const& document)
+    : NetworkExchange<NetworkMessage>::NetworkExchange(document)
     {
         ADAPTIV_ASSERT_HAS_RESPONSE_ERROR(NetworkMessage);
     }
@@ -87,9 +108,41 @@ public:
     }
 
     /// The serialized Response in JSON format
-    std::string json()
+    std::string json(JSONStyle const& style = {})
+    {
+        return encode(Format::json, style);
+    }
+
+    /**
+     * Append the Response in compact JSON to a buffer, e.g. a beast::flat_buffer
+     * about to be written, without iostreams nor cereal
+     * @param buffer A std::string or a contiguous DynamicBuffer
+     * @param precision The significant digits of floating point numbers, or
+     * zero for the shortest representation that reads back exactly
+     * @note The NetworkMessage must be made serializable with ADAPTIV_SERIALIZE
+     */
+    template<class Buffer>
+    void appendJSON(Buffer& buffer, int precision = 0) const
+    {
+        NetworkExchange<NetworkMessage>::writeJSON(
+            buffer, "response", precision);
+    }
+
+    /// The serialized Response in binary format (cereal's portable binary)
+    std::string binary()
+    {
+        return encode(Format::binary);
+    }
+
+    /**
+     * The serialized Response
+     * @param format The wire format
+     * @param style The layout of the JSON format (e.g. compact)
+     */
+    std::string encode(Format format, JSONStyle const& style = {})
     {
-        return NetworkExchange<NetworkMessage>::json("response");
+        return NetworkExchange<NetworkMessage>::encode(
+            "response", format, style);
     }
 };
 
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_ROUTER_HPP
+#define ADAPTIV_ROUTER_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <adaptiv/macros.hpp>
+#include <adaptiv/traits/traits.hpp>
+#include <adaptiv/cloud/protocol/inbound.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_PROTOCOL_NAMESPACE_BEGIN
+
+namespace traits {
+namespace detail {
+/// The last parameter of a handler: the NetworkExchange it handles
+template<class Handler>
+struct handler_exchange { };
+
+template<class R, class Arg, class... Args>
+struct handler_exchange<R (*)(Arg, Args...)>
+{
+    using type = std::tuple_element_t<
+        sizeof...(Args), std::tuple<Arg, Args...>>;
+};
+
+template<class R, class C, class... Args>
+struct handler_exchange<R (C::*)(Args...)>
+    : handler_exchange<R (*)(Args...)> { };
+
+template<class R, class C, class... Args>
+struct handler_exchange<R (C::*)(Args...) const>
+    : handler_exchange<R (*)(Args...)> { };
+
+template<class Handler>
+using handler_exchange_t =
+    std::decay_t<typename handler_exchange<Handler>::type>;
+} // namespace detail
+
+/**
+ * Detect if type \c Handler is a handler for the Router, i.e. a function
+ * (or member function) pointer taking a NetworkExchange last
+ */
+template<class Handler>
+bool constexpr is_handler_v =
+    adaptiv::traits::is_detected_v<detail::handler_exchange_t, Handler>;
+
+/// The NetworkExchange handled by \c Handler (e.g. Request<RANSRequest>)
+template<class Handler>
+using handler_exchange_t = detail::handler_exchange_t<Handler>;
+} // namespace traits
+
+/// Static assertion: assert type \c Handler is a handler for the Router
+#define ADAPTIV_ASSERT_IS_HANDLER(Handler)                              \
+static_assert(traits::is_handler_v<Handler>,                            \
+    "[adaptiv::cloud::protocol::Router] a handler is a function pointer"\
+    " taking the NetworkExchange of its target last, e.g. "             \
+    "std::string (Session::*)(Request<RANSRequest> const&)")            \
+
+/// A target and its handler \see route()
+template<class Handler>
+struct Route
+{
+    std::string_view target;
+    Handler handler;
+};
+
+/// Make a Route, deducing the type of its handler
+template<class Handler>
+constexpr Route<Handler> route(std::string_view target, Handler handler)
+{
+    ADAPTIV_ASSERT_IS_HANDLER(Handler);
+    return {target, handler};
+}
+
+/**
+ * Dispatches received NetworkExchanges to the handler of their target. The
+ * type of the NetworkExchange (e.g. Request<RANSRequest>) is deduced from the
+ * signature of the handler, so it is reconstructed straight away, and the
+ * targets are looked up with a perfect hash found at compile time (i.e. a
+ * single string comparison).
+ * @code
+ *     static constexpr auto router = protocol::makeRouter(
+ *         protocol::route("status", &Session::onStatus),
+ *         protocol::route("solve",  &Session::onSolve));
+ *
+ *     // std::string Session::onSolve(Request<RANSRequest> const& request)
+ *     auto reply = router.dispatch(inbound, this);
+ * @endcode
+ * @tparam Handlers The types of the handlers, in the order of the routes
+ */
+template<class... Handlers>
+class Router
+{
+public:
+    /// The number of routes
+    static std::size_t constexpr size = sizeof...(Handlers);
+
+    /// The value of find() for unknown targets
+    static std::size_t constexpr npos = size;
+
+    /**
+     * @throw std::invalid_argument If the targets are not unique (i.e. a
+     * compile-time error for a constexpr Router)
+     */
+    constexpr explicit Router(Route<Handlers>... routes)
+    : routes_(routes...)
+    , targets_{routes.target...}
+    {
+        for (std::size_t i = 0; i < size; ++i) {
+            for (std::size_t j = i + 1; j < size; ++j) {
+                if (targets_[i] == targets_[j]) {
+                    throw std::invalid_argument(
+                        "[adaptiv::cloud::protocol::Router] duplicate target");
+                }
+            }
+        }
+
+        // Unique targets always have a collision-free seed: look for one
+        while (!isPerfect()) ++seed_;
+    }
+
+    /// The index of the route of \c target, or npos
+    constexpr std::size_t find(std::string_view target) const noexcept
+    {
+        auto const index = table_[slot(target)];
+        return index != npos && targets_[index] == target ? index : npos;
+    }
+
+    /**
+     * Reconstruct the next NetworkExchange of a frame, and call the handler
+     * of its target with it
+     * @param inbound The received frame
+     * @param args Passed to the handler before the NetworkExchange (e.g. the
+     * object of member function handlers)
+     * @return The result of the handler, or \c std::nullopt if the target has
+     * no route (the NetworkExchange is left unread). For handlers returning
+     * void: whether the target has a route
+     * @throw std::exception If the NetworkExchange does not match its target
+     */
+    template<class... Args>
+    auto dispatch(Inbound& inbound, Args&&... args) const
+    {
+        using result_t = std::common_type_t<std::invoke_result_t<
+            Handlers, Args&&..., traits::handler_exchange_t<Handlers>>...>;
+        using call_t = result_t (*)(Router const&, Inbound&, Args&&...);
+
+        static constexpr auto calls = makeCalls<result_t, call_t, Args...>(
+            std::index_sequence_for<Handlers...>{});
+
+        auto const index = find(inbound.header().target);
+        if constexpr (std::is_void_v<result_t>) {
+            if (index == npos) return false;
+            calls[index](*this, inbound, std::forward<Args>(args)...);
+            return true;
+        } else {
+            if (index == npos) return std::optional<result_t>();
+            return std::optional<result_t>(
+                calls[index](*this, inbound, std::forward<Args>(args)...));
+        }
+    }
+
+    /**
+     * Validate the next NetworkExchange of a frame against the schema of the
+     * NetworkExchange of its handler, before dispatch() \see Inbound::check()
+     * @return An empty string if it is valid or its target has no route,
+     * otherwise the violated keyword and where
+     */
+    std::string validate(Inbound const& inbound) const
+    {
+        static constexpr std::array<std::string (Inbound::*)() const, size>
+            checks{&Inbound::check<traits::handler_exchange_t<Handlers>>...};
+
+        auto const index = find(inbound.header().target);
+        return index == npos ? std::string() : (inbound.*checks[index])();
+    }
+
+private:
+    /// Slots of the hash table (at most half full)
+    static std::size_t constexpr slots = [] {
+        std::size_t n = 1;
+        while (n < 2 * size) n *= 2;
+        return n;
+    }();
+
+    /// FNV-1a, salted with the seed
+    constexpr std::size_t slot(std::string_view target) const noexcept
+    {
+        std::uint64_t hash = 14695981039346656037ull ^ seed_;
+        for (auto c : target) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        return static_cast<std::size_t>(hash & (slots - 1));
+    }
+
+    /// Fill the table with the current seed: false on a collision
+    constexpr bool isPerfect() noexcept
+    {
+        for (auto& index : table_) index = npos;
+        for (std::size_t i = 0; i < size; ++i) {
+            auto& index = table_[slot(targets_[i])];
+            if (index != npos) return false;
+            index = i;
+        }
+        return true;
+    }
+
+    template<std::size_t I, class Result, class... Args>
+    static Result call(Router const& router, Inbound& inbound, Args&&... args)
+    {
+        using handler_t = std::tuple_element_t<I, std::tuple<Handlers...>>;
+        using exchange_t = traits::handler_exchange_t<handler_t>;
+
+        return std::invoke(
+            std::get<I>(router.routes_).handler,
+            std::forward<Args>(args)...,
+            inbound.read<exchange_t>());
+    }
+
+    template<class Result, class Call, class... Args, std::size_t... I>
+    static constexpr std::array<Call, size> makeCalls(
+        std::index_sequence<I...>)
+    {
+        return {&Router::call<I, Result, Args...>...};
+    }
+
+    std::tuple<Route<Handlers>...> routes_;
+    std::array<std::string_view, size> targets_;
+    std::uint64_t seed_ = 0;
+    std::array<std::size_t, slots> table_{}; ///< Route indices, or npos
+};
+
+/**
+ * Make a Router from its routes
+ * @code
+ *     static constexpr auto router = protocol::makeRouter(
+ *         protocol::route("solve", &Session::onSolve));
+ * @endcode
+ */
+template<class... Handlers>
+constexpr Router<Handlers...> makeRouter(Route<Handlers>... routes)
+{
+    return Router<Handlers...>(routes...);
+}
+
+ADAPTIV_PROTOCOL_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_ROUTER_HPP
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_PROTOCOL_SCHEMA_HPP
+#define ADAPTIV_PROTOCOL_SCHEMA_HPP
+
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <adaptiv/macros.hpp>
+#include <adaptiv/traits/traits.hpp>
+#include <adaptiv/serialization/json_schema.hpp>
+#include <adaptiv/serialization/external/cereal/external/rapidjson/document.h>
+#include <adaptiv/serialization/external/cereal/external/rapidjson/schema.h>
+#include <adaptiv/serialization/external/cereal/external/rapidjson/stringbuffer.h>
+#include <adaptiv/cloud/protocol/request.hpp>
+#include <adaptiv/cloud/protocol/response.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_PROTOCOL_NAMESPACE_BEGIN
+
+/**
+ * The JSON Schema of a NetworkExchange: its header and the schema of its
+ * NetworkMessage \see serialization::jsonSchema()
+ * @tparam Exchange A Request or a Response (e.g. Request<RANSRequest>)
+ */
+template<class Exchange>
+std::string schemaText()
+{
+    using message_t =
+        std::decay_t<decltype(std::declval<Exchange const&>().message())>;
+
+    auto const exchangeType =
+        adaptiv::traits::is_specialization_v<Exchange, Request> ?
+        "request" : "response";
+
+    return std::string(R"({"type":"object","properties":{")") +
+        exchangeType +
+        R"(":{"type":"object","properties":{)"
+            R"("target":{"type":"string"},)"
+            R"("id":{"type":"integer","minimum":0},)"
+            R"("message":)" + serialization::jsonSchema<message_t>() +
+        R"(},"required":["target","id","message"]}},"required":[")" +
+        exchangeType + R"("]})";
+}
+
+/**
+ * The compiled JSON Schema of a NetworkExchange
+ * @note Compiled once, on first use \note Thread-safe
+ */
+template<class Exchange>
+rapidjson::SchemaDocument const& schema()
+{
+    static rapidjson::SchemaDocument const compiled = [] {
+        rapidjson::Document document;
+        document.Parse(schemaText<Exchange>().c_str());
+        return rapidjson::SchemaDocument(document);
+    }();
+    return compiled;
+}
+
+/**
+ * Validate a parsed JSON NetworkExchange against the schema of its type,
+ * before reconstructing it (which would throw partway instead)
+ * @tparam Exchange The type of the NetworkExchange, e.g. Request<RANSRequest>
+ * @return An empty string if \c document is valid, otherwise the violated
+ * keyword and where, e.g. "type at #/request/message/iteration"
+ */
+template<class Exchange>
+std::string validate(rapidjson::Value const& document)
+{
+    rapidjson::SchemaValidator validator(schema<Exchange>());
+    if (document.Accept(validator)) return {};
+
+    rapidjson::StringBuffer where;
+    validator.GetInvalidDocumentPointer().StringifyUriFragment(where);
+    return std::string(validator.GetInvalidSchemaKeyword()) + " at " +
+        where.GetString();
+}
+
+ADAPTIV_PROTOCOL_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_PROTOCOL_SCHEMA_HPP
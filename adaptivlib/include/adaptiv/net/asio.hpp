@@ -10,8 +10,11 @@
 
 #include <adaptiv/macros.hpp>
 
+// Before Asio: <boost/asio/awaitable.hpp> uses std::exchange without it
+// (Boost 1.74, C++20)
+#include <utility>
+
 #include <boost/asio.hpp>
-#include <boost/asio/spawn.hpp>
 
 ADAPTIV_NAMESPACE_BEGIN
 ADAPTIV_NET_NAMESPACE_BEGIN
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_DEFLATE_HPP
+#define ADAPTIV_DEFLATE_HPP
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#include <adaptiv/macros.hpp>
+#include <adaptiv/net/beast.hpp>
+#include <adaptiv/traits/traits.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_NET_NAMESPACE_BEGIN
+
+/// Tuning of the permessage-deflate WebSocket extension (RFC 7692)
+struct DeflateOptions
+{
+    /**
+     * Offer (client) or accept (server) the extension. Off by default: it
+     * about doubles the CPU cost of a message, and every connection keeps
+     * a compression state, which only pays off on thin links
+     */
+    bool enable = false;
+
+    /// Base two logarithm of the LZ77 window, 9..15 (memory vs ratio)
+    int windowBits = 15;
+
+    /// Memory used for the internal compression state, 1..9 (speed vs ratio)
+    int memLevel = 4;
+
+    /**
+     * Messages smaller than this are sent uncompressed
+     * @note Requires a Beast version with permessage_deflate::msg_size_threshold
+     * (see hasDeflateThreshold), otherwise every message is compressed
+     */
+    std::size_t threshold = 0;
+};
+
+namespace detail {
+
+template<class T>
+using msg_size_threshold_t = decltype(std::declval<T&>().msg_size_threshold);
+
+/// Set the compression threshold, if this version of Beast supports it
+template<class PermessageDeflate>
+void setThreshold(PermessageDeflate& deflate, std::size_t threshold)
+{
+    if constexpr (adaptiv::traits::is_detected_v<
+        msg_size_threshold_t, PermessageDeflate>) {
+        deflate.msg_size_threshold = threshold;
+    }
+}
+
+} // namespace detail
+
+/// This version of Beast honours DeflateOptions::threshold (Boost 1.75)
+inline constexpr bool hasDeflateThreshold = adaptiv::traits::is_detected_v<
+    detail::msg_size_threshold_t, beast::websocket::permessage_deflate>;
+
+/**
+ * Convert the value of a command line option (--name=value) to an unsigned
+ * integer
+ * @throws std::invalid_argument If \c value is not an unsigned integer
+ */
+std::size_t toUnsigned(std::string const& name, std::string const& value);
+
+/**
+ * Convert the value of a command line option to an integer in [min, max]
+ * @throws std::invalid_argument If \c value is not in the range
+ */
+int toBounded(std::string const& name, std::string const& value,
+              int min, int max);
+
+/**
+ * Set a deflate option given on a command line as --name=value (shared by the
+ * server and the client): deflate, deflate-window-bits, deflate-mem-level or
+ * deflate-threshold
+ * @return False if \c name is not a deflate option
+ * @throws std::invalid_argument If the value is invalid, or the option is not
+ * supported by this version of Beast
+ */
+bool parseDeflateOption(
+    DeflateOptions& options,
+    std::string const& name,
+    std::string const& value);
+
+/// The usage of the deflate options, for a command line help text
+std::string deflateUsage();
+
+/**
+ * Make the permessage-deflate option of a websocket stream
+ * @param options The tuning of the extension
+ * @param role The role of the stream (the extension is enabled for it only)
+ */
+inline beast::websocket::permessage_deflate permessageDeflate(
+    DeflateOptions const& options,
+    beast::role_type role)
+{
+    beast::websocket::permessage_deflate deflate;
+    deflate.server_enable = options.enable && role == beast::role_type::server;
+    deflate.client_enable = options.enable && role == beast::role_type::client;
+    deflate.server_max_window_bits = options.windowBits;
+    deflate.client_max_window_bits = options.windowBits;
+    deflate.memLevel = options.memLevel;
+    detail::setThreshold(deflate, options.threshold);
+    return deflate;
+}
+
+ADAPTIV_NET_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_DEFLATE_HPP
@@ -15,6 +15,7 @@
 
 #include <adaptiv/net/asio.hpp>
 #include <adaptiv/net/beast.hpp>
+#include <adaptiv/net/deflate.hpp>
 #include <adaptiv/system/system.hpp>
 
 #endif //ADAPTIV_NET_HPP
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_BOUNDED_BINARY_HPP
+#define ADAPTIV_BOUNDED_BINARY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include <adaptiv/macros.hpp>
+#include <adaptiv/serialization/external/cereal/archives/portable_binary.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_SERIALIZATION_NAMESPACE_BEGIN
+
+/**
+ * A cereal input archive for portable binary data received from a peer:
+ * cereal's PortableBinaryInputArchive, with every size (e.g. of a string or
+ * a vector) checked against the bytes left in the stream
+ * @note cereal resizes a container to the size it reads before reading the
+ * elements, so a few bytes claiming a huge string would otherwise allocate
+ * (and zero) that much. Every element takes at least a byte, so a size
+ * larger than the bytes left can not be valid
+ * @note Reads what cereal::PortableBinaryOutputArchive writes
+ */
+class BoundedBinaryInputArchive
+    : public cereal::InputArchive<BoundedBinaryInputArchive,
+                                  cereal::AllowEmptyClassElision>
+{
+public:
+    /**
+     * Construct, reading from the provided stream
+     * @param stream A stream that can seek (e.g. a std::istringstream or a
+     * MemoryInputStream), so that the bytes left in it are known
+     * @throw cereal::Exception If the stream can not tell its size
+     */
+    explicit BoundedBinaryInputArchive(std::istream& stream)
+    : cereal::InputArchive<BoundedBinaryInputArchive,
+                           cereal::AllowEmptyClassElision>(this)
+    , buffer_(*stream.rdbuf())
+    {
+        auto constexpr in = std::ios_base::in;
+        std::streamoff const position =
+            buffer_.pubseekoff(0, std::ios_base::cur, in);
+        std::streamoff const end =
+            buffer_.pubseekoff(0, std::ios_base::end, in);
+        if (position == -1 || end == -1 ||
+            std::streamoff(buffer_.pubseekpos(position, in)) == -1) {
+            throw cereal::Exception(
+                "[adaptiv::serialization::BoundedBinaryInputArchive] "
+                "the stream can not tell its size");
+        }
+        remaining_ = static_cast<std::size_t>(end - position);
+
+        std::uint8_t isLittleEndian;
+        (*this)(isLittleEndian);
+        isSwapped_ = isLittleEndian !=
+            cereal::portable_binary_detail::is_little_endian();
+    }
+
+    /// @name Internal functionality (i.e. used by cereal), as in
+    /// cereal::PortableBinaryInputArchive
+    /// @{
+
+    /// Reads \c size bytes of elements of \c DataSize bytes each
+    template<std::size_t DataSize>
+    void loadBinary(void* const data, std::size_t size)
+    {
+        if (size > remaining_) {
+            throw cereal::Exception(
+                "[adaptiv::serialization::BoundedBinaryInputArchive] "
+                "failed to read " + std::to_string(size) + " bytes, " +
+                std::to_string(remaining_) + " left");
+        }
+
+        auto const bytes = static_cast<std::size_t>(
+            buffer_.sgetn(static_cast<char*>(data),
+                          static_cast<std::streamsize>(size)));
+        remaining_ -= bytes;
+        if (bytes != size) {
+            throw cereal::Exception(
+                "[adaptiv::serialization::BoundedBinaryInputArchive] "
+                "failed to read " + std::to_string(size) + " bytes");
+        }
+
+        if (isSwapped_) {
+            auto const values = static_cast<std::uint8_t*>(data);
+            for (std::size_t i = 0; i < size; i += DataSize) {
+                cereal::portable_binary_detail::swap_bytes<DataSize>(
+                    values + i);
+            }
+        }
+    }
+
+    /// Rejects the size of a container that the stream can not hold
+    void checkSize(cereal::size_type size) const
+    {
+        if (size > remaining_) {
+            throw cereal::Exception(
+                "[adaptiv::serialization::BoundedBinaryInputArchive] "
+                "a size of " + std::to_string(size) + " with " +
+                std::to_string(remaining_) + " bytes left");
+        }
+    }
+    /// @}
+
+private:
+    std::streambuf& buffer_;
+    std::size_t remaining_ = 0;
+    bool isSwapped_ = false;
+};
+
+// [cereal load functions] -------------------------------------------- begin
+// The same as cereal's for the PortableBinaryInputArchive (found by ADL)
+
+template<class T, cereal::traits::EnableIf<std::is_arithmetic_v<T>>
+    = cereal::traits::sfinae>
+void CEREAL_LOAD_FUNCTION_NAME(BoundedBinaryInputArchive& ar, T& t)
+{
+    static_assert(!std::is_floating_point_v<T> ||
+                  std::numeric_limits<T>::is_iec559,
+        "Portable binary only supports IEEE 754 floating point");
+    ar.template loadBinary<sizeof(T)>(std::addressof(t), sizeof(t));
+}
+
+template<class T>
+void CEREAL_LOAD_FUNCTION_NAME(BoundedBinaryInputArchive& ar,
+                               cereal::NameValuePair<T>& t)
+{
+    ar(t.value);
+}
+
+/// The size is checked before cereal allocates anything for it
+template<class T>
+void CEREAL_LOAD_FUNCTION_NAME(BoundedBinaryInputArchive& ar,
+                               cereal::SizeTag<T>& t)
+{
+    ar(t.size);
+    ar.checkSize(static_cast<cereal::size_type>(t.size));
+}
+
+template<class T>
+void CEREAL_LOAD_FUNCTION_NAME(BoundedBinaryInputArchive& ar,
+                               cereal::BinaryData<T>& bd)
+{
+    using Element = std::remove_pointer_t<T>;
+    static_assert(!std::is_floating_point_v<Element> ||
+                  std::numeric_limits<Element>::is_iec559,
+        "Portable binary only supports IEEE 754 floating point");
+    ar.template loadBinary<sizeof(Element)>(
+        bd.data, static_cast<std::size_t>(bd.size));
+}
+// [cereal load functions] ---------------------------------------------- end
+
+ADAPTIV_SERIALIZATION_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+// Register the archive for polymorphic support
+CEREAL_REGISTER_ARCHIVE(adaptiv::serialization::BoundedBinaryInputArchive)
+
+// Written with the PortableBinaryOutputArchive (which keeps its own input
+// archive)
+namespace cereal { namespace traits { namespace detail {
+template<>
+struct get_output_from_input<
+    adaptiv::serialization::BoundedBinaryInputArchive>
+{ using type = cereal::PortableBinaryOutputArchive; };
+} } } // namespace cereal::traits::detail
+
+#endif //ADAPTIV_BOUNDED_BINARY_HPP
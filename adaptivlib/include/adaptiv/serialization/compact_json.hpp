@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_COMPACT_JSON_HPP
+#define ADAPTIV_COMPACT_JSON_HPP
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stack>
+#include <string>
+#include <type_traits>
+
+#include <adaptiv/macros.hpp>
+#include <adaptiv/serialization/external/cereal/archives/json.hpp>
+#include <adaptiv/serialization/external/cereal/external/rapidjson/writer.h>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_SERIALIZATION_NAMESPACE_BEGIN
+
+/**
+ * A cereal output archive for JSON on the wire: cereal's JSONOutputArchive
+ * without whitespace (i.e. not pretty-printed) and with floating point
+ * numbers written with a given number of significant digits.
+ * @note The output is read back with cereal::JSONInputArchive
+ * @note cereal's precision option counts decimal places, so it would write
+ * a residual of 1e-8 as 0.0: this archive counts significant digits instead
+ */
+class CompactJSONOutputArchive
+    : public cereal::OutputArchive<CompactJSONOutputArchive>
+    , public cereal::traits::TextArchive
+{
+    enum class NodeType { StartObject, InObject, StartArray, InArray };
+
+    using WriteStream = CEREAL_RAPIDJSON_NAMESPACE::OStreamWrapper;
+    using JSONWriter  = CEREAL_RAPIDJSON_NAMESPACE::Writer<WriteStream>;
+
+public:
+    /// Enough significant digits to write any double without loss
+    static int constexpr maxPrecision =
+        std::numeric_limits<double>::max_digits10;
+
+    /**
+     * Construct, outputting to the provided stream
+     * @param stream The stream to output to
+     * @param precision The significant digits of floating point numbers, or
+     * zero for the shortest representation that reads back exactly
+     */
+    explicit CompactJSONOutputArchive(
+        std::ostream& stream,
+        int precision = 0)
+    : cereal::OutputArchive<CompactJSONOutputArchive>(this)
+    , writeStream_(stream)
+    , writer_(writeStream_)
+    , precision_(precision < 0 ? 0 :
+                 precision > maxPrecision ? maxPrecision : precision)
+    {
+        nameCounter_.push(0);
+        nodeStack_.push(NodeType::StartObject);
+    }
+
+    /// Flushes the JSON
+    ~CompactJSONOutputArchive() CEREAL_NOEXCEPT
+    {
+        if (nodeStack_.top() == NodeType::InObject) {
+            writer_.EndObject();
+        } else if (nodeStack_.top() == NodeType::InArray) {
+            writer_.EndArray();
+        }
+    }
+
+    /// @name Internal functionality (i.e. used by cereal), as in
+    /// cereal::JSONOutputArchive
+    /// @{
+
+    /// Starts a new node, optionally named by calling setNextName() before
+    void startNode()
+    {
+        writeName();
+        nodeStack_.push(NodeType::StartObject);
+        nameCounter_.push(0);
+    }
+
+    /// Designates the most recently added node as finished
+    void finishNode()
+    {
+        // Empty objects/arrays never called writeName(): start them here
+        switch (nodeStack_.top()) {
+        case NodeType::StartArray:
+            writer_.StartArray();
+            [[fallthrough]];
+        case NodeType::InArray:
+            writer_.EndArray();
+            break;
+        case NodeType::StartObject:
+            writer_.StartObject();
+            [[fallthrough]];
+        case NodeType::InObject:
+            writer_.EndObject();
+            break;
+        }
+
+        nodeStack_.pop();
+        nameCounter_.pop();
+    }
+
+    /// Sets the name for the next node created with startNode()
+    void setNextName(char const* name) { nextName_ = name; }
+
+    void saveValue(bool b)           { writer_.Bool(b); }
+    void saveValue(int i)            { writer_.Int(i); }
+    void saveValue(unsigned u)       { writer_.Uint(u); }
+    void saveValue(std::int64_t i)   { writer_.Int64(i); }
+    void saveValue(std::uint64_t u)  { writer_.Uint64(u); }
+    void saveValue(std::nullptr_t)   { writer_.Null(); }
+    void saveValue(char const* s)    { writer_.String(s); }
+
+    void saveValue(std::string const& s)
+    {
+        writer_.String(s.c_str(),
+            static_cast<CEREAL_RAPIDJSON_NAMESPACE::SizeType>(s.size()));
+    }
+
+    /// Saves a double using the significant digits of the archive
+    void saveValue(double d)
+    {
+        // Let rapidjson handle NaN and infinity
+        if (!std::isfinite(d)) {
+            writer_.Double(d);
+            return;
+        }
+
+        char buffer[32];
+        auto const result = precision_ == 0 ?
+            std::to_chars(buffer, buffer + sizeof(buffer), d) :
+            std::to_chars(buffer, buffer + sizeof(buffer), d,
+                          std::chars_format::general, precision_);
+        writer_.RawValue(
+            buffer,
+            static_cast<std::size_t>(result.ptr - buffer),
+            CEREAL_RAPIDJSON_NAMESPACE::kNumberType);
+    }
+
+    /// Serialize a long (unsigned long) if it would not be caught otherwise
+    template<class T, cereal::traits::EnableIf<
+        std::is_same_v<T, long> || std::is_same_v<T, unsigned long>,
+        !std::is_same_v<T, std::int32_t>,
+        !std::is_same_v<T, std::int64_t>,
+        !std::is_same_v<T, std::uint32_t>,
+        !std::is_same_v<T, std::uint64_t>> = cereal::traits::sfinae>
+    void saveValue(T t)
+    {
+        if constexpr (std::is_signed_v<T>) {
+            saveValue(static_cast<std::int64_t>(t));
+        } else {
+            saveValue(static_cast<std::uint64_t>(t));
+        }
+    }
+
+    /// Save exotic arithmetic (e.g. long double) as strings
+    template<class T, cereal::traits::EnableIf<
+        std::is_arithmetic_v<T>,
+        !std::is_same_v<T, long>,
+        !std::is_same_v<T, unsigned long>,
+        !std::is_same_v<T, std::int64_t>,
+        !std::is_same_v<T, std::uint64_t>,
+        (sizeof(T) >= sizeof(long double) || sizeof(T) >= sizeof(long long))>
+        = cereal::traits::sfinae>
+    void saveValue(T const& t)
+    {
+        std::stringstream ss;
+        ss.precision(std::numeric_limits<long double>::max_digits10);
+        ss << t;
+        saveValue(ss.str());
+    }
+
+    /// Write the name of the upcoming node and prepare object/array state
+    void writeName()
+    {
+        NodeType const& nodeType = nodeStack_.top();
+
+        // Start up either an object or an array, depending on state
+        if (nodeType == NodeType::StartArray) {
+            writer_.StartArray();
+            nodeStack_.top() = NodeType::InArray;
+        } else if (nodeType == NodeType::StartObject) {
+            nodeStack_.top() = NodeType::InObject;
+            writer_.StartObject();
+        }
+
+        // Array types do not output names
+        if (nodeType == NodeType::InArray) return;
+
+        if (nextName_ == nullptr) {
+            saveValue("value" + std::to_string(nameCounter_.top()++));
+        } else {
+            saveValue(nextName_);
+            nextName_ = nullptr;
+        }
+    }
+
+    /// Designates that the current node should be output as an array
+    void makeArray() { nodeStack_.top() = NodeType::StartArray; }
+    /// @}
+
+private:
+    WriteStream writeStream_;
+    JSONWriter writer_;
+    int const precision_;
+    char const* nextName_ = nullptr;
+    std::stack<std::uint32_t> nameCounter_; ///< Names unnamed nodes
+    std::stack<NodeType> nodeStack_;
+};
+
+// [cereal prologue/epilogue and save functions] ---------------------- begin
+// The same as cereal's for the JSONOutputArchive (found by ADL)
+
+/// NVPs do not start or finish nodes - they just set up the names
+template<class T>
+void prologue(CompactJSONOutputArchive&, cereal::NameValuePair<T> const&) { }
+
+template<class T>
+void epilogue(CompactJSONOutputArchive&, cereal::NameValuePair<T> const&) { }
+
+/// SizeTags are not saved, they make the current node an array
+template<class T>
+void prologue(CompactJSONOutputArchive& ar, cereal::SizeTag<T> const&)
+{
+    ar.makeArray();
+}
+
+template<class T>
+void epilogue(CompactJSONOutputArchive&, cereal::SizeTag<T> const&) { }
+
+/// Other types (except minimal ones) start and finish a node
+template<class T, cereal::traits::EnableIf<
+    !std::is_arithmetic_v<T>,
+    !cereal::traits::has_minimal_base_class_serialization<T,
+        cereal::traits::has_minimal_output_serialization,
+        CompactJSONOutputArchive>::value,
+    !cereal::traits::has_minimal_output_serialization<T,
+        CompactJSONOutputArchive>::value> = cereal::traits::sfinae>
+void prologue(CompactJSONOutputArchive& ar, T const&)
+{
+    ar.startNode();
+}
+
+template<class T, cereal::traits::EnableIf<
+    !std::is_arithmetic_v<T>,
+    !cereal::traits::has_minimal_base_class_serialization<T,
+        cereal::traits::has_minimal_output_serialization,
+        CompactJSONOutputArchive>::value,
+    !cereal::traits::has_minimal_output_serialization<T,
+        CompactJSONOutputArchive>::value> = cereal::traits::sfinae>
+void epilogue(CompactJSONOutputArchive& ar, T const&)
+{
+    ar.finishNode();
+}
+
+inline void prologue(CompactJSONOutputArchive& ar, std::nullptr_t const&)
+{
+    ar.writeName();
+}
+
+inline void epilogue(CompactJSONOutputArchive&, std::nullptr_t const&) { }
+
+template<class T, cereal::traits::EnableIf<std::is_arithmetic_v<T>>
+    = cereal::traits::sfinae>
+void prologue(CompactJSONOutputArchive& ar, T const&)
+{
+    ar.writeName();
+}
+
+template<class T, cereal::traits::EnableIf<std::is_arithmetic_v<T>>
+    = cereal::traits::sfinae>
+void epilogue(CompactJSONOutputArchive&, T const&) { }
+
+template<class CharT, class Traits, class Alloc>
+void prologue(CompactJSONOutputArchive& ar,
+              std::basic_string<CharT, Traits, Alloc> const&)
+{
+    ar.writeName();
+}
+
+template<class CharT, class Traits, class Alloc>
+void epilogue(CompactJSONOutputArchive&,
+              std::basic_string<CharT, Traits, Alloc> const&) { }
+
+template<class T>
+void CEREAL_SAVE_FUNCTION_NAME(CompactJSONOutputArchive& ar,
+                               cereal::NameValuePair<T> const& t)
+{
+    ar.setNextName(t.name);
+    ar(t.value);
+}
+
+inline void CEREAL_SAVE_FUNCTION_NAME(CompactJSONOutputArchive& ar,
+                                      std::nullptr_t const& t)
+{
+    ar.saveValue(t);
+}
+
+template<class T, cereal::traits::EnableIf<std::is_arithmetic_v<T>>
+    = cereal::traits::sfinae>
+void CEREAL_SAVE_FUNCTION_NAME(CompactJSONOutputArchive& ar, T const& t)
+{
+    ar.saveValue(t);
+}
+
+template<class CharT, class Traits, class Alloc>
+void CEREAL_SAVE_FUNCTION_NAME(CompactJSONOutputArchive& ar,
+    std::basic_string<CharT, Traits, Alloc> const& str)
+{
+    ar.saveValue(str);
+}
+
+template<class T>
+void CEREAL_SAVE_FUNCTION_NAME(CompactJSONOutputArchive&,
+                               cereal::SizeTag<T> const&)
+{
+    // Nothing to do here, the size is not saved explicitly
+}
+// [cereal prologue/epilogue and save functions] ------------------------ end
+
+ADAPTIV_SERIALIZATION_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+// Register the archive for polymorphic support
+CEREAL_REGISTER_ARCHIVE(adaptiv::serialization::CompactJSONOutputArchive)
+
+// Read back with the JSONInputArchive (which keeps its own output archive)
+namespace cereal { namespace traits { namespace detail {
+template<>
+struct get_input_from_output<adaptiv::serialization::CompactJSONOutputArchive>
+{ using type = cereal::JSONInputArchive; };
+} } } // namespace cereal::traits::detail
+
+#endif //ADAPTIV_COMPACT_JSON_HPP
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_DIRECT_JSON_HPP
+#define ADAPTIV_DIRECT_JSON_HPP
+
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <adaptiv/macros.hpp>
+#include <adaptiv/traits/traits.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_SERIALIZATION_NAMESPACE_BEGIN
+
+namespace traits {
+namespace detail {
+template<class T>
+using serialized_members_t = typename T::serialized_members_t;
+
+template<class T, class = void>
+struct is_direct_json_serializable
+    : std::bool_constant<(std::is_arithmetic_v<T> &&
+                          !std::is_same_v<T, long double>) ||
+                         adaptiv::traits::is_basic_string_v<T>> { };
+
+template<class T, class Allocator>
+struct is_direct_json_serializable<std::vector<T, Allocator>>
+    : is_direct_json_serializable<T> { };
+
+template<class... Members>
+struct is_direct_json_serializable<std::tuple<Members...>>
+    : std::conjunction<is_direct_json_serializable<Members>...> { };
+
+template<class T>
+struct is_direct_json_serializable<T, std::enable_if_t<
+    adaptiv::traits::is_detected_v<serialized_members_t, T>>>
+    : is_direct_json_serializable<typename T::serialized_members_t> { };
+} // namespace detail
+
+/**
+ * Detect if type \c T can be written by the DirectJSONWriter: arithmetic
+ * types, strings, vectors of those, and classes made serializable with
+ * ADAPTIV_SERIALIZE whose members are all of those
+ */
+template<class T>
+bool constexpr is_direct_json_serializable_v =
+    detail::is_direct_json_serializable<T>::value;
+} // namespace traits
+
+/**
+ * Writes compact JSON straight into a growable buffer, without iostreams nor
+ * cereal: classes are walked through the members listed by ADAPTIV_SERIALIZE.
+ * The output is the same as the CompactJSONOutputArchive's, and so it is read
+ * back with cereal's JSON input archives.
+ * @tparam Buffer A std::string, or a contiguous DynamicBuffer (e.g.
+ * beast::flat_buffer), appended to
+ * @code
+ *     std::string out;
+ *     {
+ *         serialization::DirectJSONWriter writer(out, 6);
+ *         writer.write("response", result); // {"response":{...}}
+ *     } // or writer.flush()
+ * @endcode
+ * @note Small writes are staged in the writer and appended to the buffer in
+ * chunks: the output is complete once flushed (the destructor flushes)
+ */
+template<class Buffer>
+class DirectJSONWriter
+{
+public:
+    /// Enough significant digits to write any double without loss
+    static int constexpr maxPrecision =
+        std::numeric_limits<double>::max_digits10;
+
+    /**
+     * Construct, appending to the provided buffer
+     * @param buffer The buffer to append to
+     * @param precision The significant digits of floating point numbers, or
+     * zero for the shortest representation that reads back exactly
+     */
+    explicit DirectJSONWriter(Buffer& buffer, int precision = 0)
+    : buffer_(buffer)
+    , precision_(precision < 0 ? 0 :
+                 precision > maxPrecision ? maxPrecision : precision)
+    { }
+
+    DirectJSONWriter(DirectJSONWriter const&) = delete;
+    DirectJSONWriter& operator=(DirectJSONWriter const&) = delete;
+
+    /// Flushes the JSON
+    ~DirectJSONWriter() { flush(); }
+
+    /**
+     * Write a named value as the root of the JSON, i.e. {"name":value}, as
+     * cereal's archives do
+     */
+    template<class T>
+    void write(std::string_view name, T const& value)
+    {
+        put('{');
+        isFirst_ = true;
+        (*this)(name, value);
+        put('}');
+    }
+
+    /// Write a member of the current object (e.g. called by visitMembers())
+    template<class T>
+    void operator()(std::string_view name, T const& value)
+    {
+        if (!isFirst_) put(',');
+        isFirst_ = false;
+
+        // Member names are identifiers: nothing to escape
+        put('"');
+        put(name);
+        put("\":");
+        writeValue(value);
+    }
+
+    /// Append the staged output to the buffer
+    void flush()
+    {
+        append(scratch_, size_);
+        size_ = 0;
+    }
+
+private:
+    void writeValue(bool b) { put(b ? "true" : "false"); }
+
+    /// Saves a double using the significant digits of the writer
+    void writeValue(double d)
+    {
+        // As rapidjson with kWriteNanAndInfFlag (cereal's default)
+        if (!std::isfinite(d)) {
+            put(std::isnan(d) ? "NaN" : d < 0 ? "-Infinity" : "Infinity");
+            return;
+        }
+
+        auto out = reserve(32);
+        auto const result = precision_ == 0 ?
+            std::to_chars(out, out + 32, d) :
+            std::to_chars(out, out + 32, d,
+                          std::chars_format::general, precision_);
+        size_ += static_cast<std::size_t>(result.ptr - out);
+    }
+
+    template<class T, std::enable_if_t<
+        std::is_arithmetic_v<T> && !std::is_same_v<T, bool>, int> = 0>
+    void writeValue(T t)
+    {
+        if constexpr (std::is_floating_point_v<T>) {
+            writeValue(static_cast<double>(t));
+        } else {
+            auto out = reserve(24);
+            size_ += static_cast<std::size_t>(
+                std::to_chars(out, out + 24, t).ptr - out);
+        }
+    }
+
+    /// Saves a string, escaped as rapidjson does
+    template<class CharT, class Traits, class Allocator>
+    void writeValue(std::basic_string<CharT, Traits, Allocator> const& s)
+    {
+        static char constexpr hex[] = "0123456789ABCDEF";
+
+        put('"');
+        auto begin = s.data();
+        auto const end = begin + s.size();
+        for (auto c = begin; c != end; ++c) {
+            auto const u = static_cast<unsigned char>(*c);
+            if (u >= 0x20 && u != '"' && u != '\\') continue;
+
+            // Copy the run of plain characters, and then the escaped one
+            put(std::string_view(begin, static_cast<std::size_t>(c - begin)));
+            begin = c + 1;
+            switch (u) {
+            case '"':  put("\\\""); break;
+            case '\\': put("\\\\"); break;
+            case '\b': put("\\b");  break;
+            case '\f': put("\\f");  break;
+            case '\n': put("\\n");  break;
+            case '\r': put("\\r");  break;
+            case '\t': put("\\t");  break;
+            default:
+                put("\\u00");
+                put(hex[u >> 4]);
+                put(hex[u & 0xF]);
+            }
+        }
+        put(std::string_view(begin, static_cast<std::size_t>(end - begin)));
+        put('"');
+    }
+
+    template<class T, class Allocator>
+    void writeValue(std::vector<T, Allocator> const& v)
+    {
+        put('[');
+        for (std::size_t i = 0; i < v.size(); ++i) {
+            if (i != 0) put(',');
+            writeValue(v[i]);
+        }
+        put(']');
+    }
+
+    /// Saves a class through the members listed by ADAPTIV_SERIALIZE
+    template<class T, std::enable_if_t<adaptiv::traits::is_detected_v<
+        traits::detail::serialized_members_t, T>, int> = 0>
+    void writeValue(T const& t)
+    {
+        put('{');
+        isFirst_ = true;
+        t.visitMembers(*this);
+        isFirst_ = false;
+        put('}');
+    }
+
+    // [staging] --------------------------------------------------------- begin
+    /// Room for \c size more characters in the staging area
+    char* reserve(std::size_t size)
+    {
+        if (size_ + size > sizeof(scratch_)) flush();
+        return scratch_ + size_;
+    }
+
+    void put(char c) { *reserve(1) = c; ++size_; }
+
+    void put(std::string_view s)
+    {
+        if (s.size() > sizeof(scratch_)) {
+            flush();
+            append(s.data(), s.size());
+            return;
+        }
+        std::memcpy(reserve(s.size()), s.data(), s.size());
+        size_ += s.size();
+    }
+
+    void append(char const* data, std::size_t size)
+    {
+        if (size == 0) return;
+        if constexpr (adaptiv::traits::is_basic_string_v<Buffer>) {
+            buffer_.append(data, size);
+        } else {
+            std::memcpy(buffer_.prepare(size).data(), data, size);
+            buffer_.commit(size);
+        }
+    }
+
+    char scratch_[512];
+    std::size_t size_ = 0;
+    // [staging] ----------------------------------------------------------- end
+
+    Buffer& buffer_;
+    int const precision_;
+    bool isFirst_ = true; ///< No member written yet to the current object
+};
+
+ADAPTIV_SERIALIZATION_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_DIRECT_JSON_HPP
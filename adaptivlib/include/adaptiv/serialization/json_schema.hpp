@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_JSON_SCHEMA_HPP
+#define ADAPTIV_JSON_SCHEMA_HPP
+
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <adaptiv/macros.hpp>
+#include <adaptiv/traits/traits.hpp>
+#include <adaptiv/serialization/direct_json.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_SERIALIZATION_NAMESPACE_BEGIN
+
+namespace detail {
+template<class T>
+struct is_vector : std::false_type { };
+
+template<class T, class Allocator>
+struct is_vector<std::vector<T, Allocator>> : std::true_type { };
+
+template<class T>
+void writeSchema(std::string& out);
+
+/// Writes the properties of an object, and lists them as required
+class SchemaVisitor
+{
+public:
+    explicit SchemaVisitor(std::string& out) : out_(out) { }
+
+    template<class T>
+    void operator()(std::string_view name, T const&)
+    {
+        auto const separator = required_.empty() ? "" : ",";
+        (out_ += separator) += '"';
+        (out_ += name) += "\":";
+        writeSchema<T>(out_);
+
+        (required_ += separator) += '"';
+        (required_ += name) += '"';
+    }
+
+    std::string const& required() const noexcept { return required_; }
+
+private:
+    std::string& out_;
+    std::string required_;
+};
+
+template<class T>
+void writeSchema(std::string& out)
+{
+    if constexpr (std::is_same_v<T, bool>) {
+        out += R"({"type":"boolean"})";
+    } else if constexpr (std::is_integral_v<T> && std::is_unsigned_v<T>) {
+        out += R"({"type":"integer","minimum":0})";
+    } else if constexpr (std::is_integral_v<T>) {
+        out += R"({"type":"integer"})";
+    } else if constexpr (std::is_floating_point_v<T>) {
+        out += R"({"type":"number"})";
+    } else if constexpr (adaptiv::traits::is_basic_string_v<T>) {
+        out += R"({"type":"string"})";
+    } else if constexpr (is_vector<T>::value) {
+        out += R"({"type":"array","items":)";
+        writeSchema<typename T::value_type>(out);
+        out += '}';
+    } else if constexpr (adaptiv::traits::is_detected_v<
+        traits::detail::serialized_members_t, T>) {
+        out += R"({"type":"object","properties":{)";
+        SchemaVisitor visitor(out);
+        T const layout{};
+        layout.visitMembers(visitor);
+        out += R"(},"required":[)";
+        out += visitor.required();
+        out += "]}";
+    } else {
+        // The members are only known to cereal
+        out += R"({"type":"object"})";
+    }
+}
+} // namespace detail
+
+/**
+ * A JSON Schema (draft 04) of the JSON of type \c T, as written by cereal's
+ * archives: classes made serializable with ADAPTIV_SERIALIZE are objects
+ * requiring each of their members, with the schema of its type
+ * @note Other classes (i.e. with hand written serialization functions) are
+ * only required to be objects
+ * @note Classes are default constructed to walk their members
+ */
+template<class T>
+std::string jsonSchema()
+{
+    std::string schema;
+    detail::writeSchema<T>(schema);
+    return schema;
+}
+
+ADAPTIV_SERIALIZATION_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_JSON_SCHEMA_HPP
@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_JSON_VALUE_HPP
+#define ADAPTIV_JSON_VALUE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+#include <adaptiv/macros.hpp>
+#include <adaptiv/serialization/external/cereal/archives/json.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_SERIALIZATION_NAMESPACE_BEGIN
+
+/**
+ * A cereal input archive for JSON that has already been parsed: cereal's
+ * JSONInputArchive, reading from a rapidjson value instead of parsing a
+ * stream into a document of its own
+ * @note The value (and the document holding it) must outlive the archive
+ * @note Used to reconstruct the items of a batch, or an exchange whose
+ * header has been peeked, without parsing them again
+ */
+class JSONValueInputArchive
+    : public cereal::InputArchive<JSONValueInputArchive>
+    , public cereal::traits::TextArchive
+{
+    using JSONValue = CEREAL_RAPIDJSON_NAMESPACE::Value;
+    using MemberIterator = JSONValue::ConstMemberIterator;
+    using ValueIterator = JSONValue::ConstValueIterator;
+
+    /// Iterates both the members of an object and the values of an array
+    class Iterator
+    {
+    public:
+        Iterator(MemberIterator begin, MemberIterator end)
+        : memberBegin_(begin)
+        , memberEnd_(end)
+        , type_(begin == end ? Type::empty : Type::member)
+        { }
+
+        Iterator(ValueIterator begin, ValueIterator end)
+        : valueBegin_(begin)
+        , valueEnd_(end)
+        , type_(begin == end ? Type::empty : Type::value)
+        { }
+
+        /// Advance to the next node
+        Iterator& operator++()
+        {
+            ++index_;
+            return *this;
+        }
+
+        /// The value of the current node
+        JSONValue const& value() const
+        {
+            switch (type_) {
+            case Type::value:  return valueBegin_[index_];
+            case Type::member: return memberBegin_[index_].value;
+            case Type::empty:  break;
+            }
+            throw cereal::Exception(
+                "[adaptiv::serialization::JSONValueInputArchive] "
+                "null or empty iterator to object or array");
+        }
+
+        /// The name of the current node, or \c nullptr if it has no name
+        char const* name() const
+        {
+            if (type_ == Type::member && memberBegin_ + index_ != memberEnd_) {
+                return memberBegin_[index_].name.GetString();
+            }
+            return nullptr;
+        }
+
+        /// Move to the node with the given name \throw cereal::Exception
+        void search(char const* searchName)
+        {
+            std::size_t index = 0;
+            for (auto it = memberBegin_; it != memberEnd_; ++it, ++index) {
+                if (std::strcmp(searchName, it->name.GetString()) == 0) {
+                    index_ = index;
+                    return;
+                }
+            }
+
+            throw cereal::Exception(
+                "JSON Parsing failed - provided NVP (" +
+                std::string(searchName) + ") not found");
+        }
+
+    private:
+        MemberIterator memberBegin_, memberEnd_;
+        ValueIterator valueBegin_, valueEnd_;
+        std::size_t index_ = 0;
+        enum class Type { value, member, empty } type_;
+    };
+
+public:
+    /**
+     * Construct, reading from the provided value
+     * @param value A parsed JSON object or array
+     */
+    explicit JSONValueInputArchive(JSONValue const& value)
+    : cereal::InputArchive<JSONValueInputArchive>(this)
+    , root_(value)
+    {
+        if (value.IsArray()) {
+            iterators_.emplace_back(value.Begin(), value.End());
+        } else if (value.IsObject()) {
+            iterators_.emplace_back(value.MemberBegin(), value.MemberEnd());
+        } else {
+            throw cereal::Exception(
+                "[adaptiv::serialization::JSONValueInputArchive] "
+                "the value is neither an object nor an array");
+        }
+    }
+
+    /// @name Internal functionality (i.e. used by cereal), as in
+    /// cereal::JSONInputArchive
+    /// @{
+
+    /// Starts a new node, going into its iterator
+    void startNode()
+    {
+        search();
+
+        auto const& value = iterators_.back().value();
+        if (value.IsArray()) {
+            iterators_.emplace_back(value.Begin(), value.End());
+        } else {
+            iterators_.emplace_back(value.MemberBegin(), value.MemberEnd());
+        }
+    }
+
+    /// Finishes the most recently started node
+    void finishNode()
+    {
+        iterators_.pop_back();
+        ++iterators_.back();
+    }
+
+    /// The name of the current node, or \c nullptr if it has no name
+    char const* getNodeName() const { return iterators_.back().name(); }
+
+    /// Sets the name for the next node created with startNode()
+    void setNextName(char const* name) { nextName_ = name; }
+
+    template<class T, cereal::traits::EnableIf<
+        std::is_signed_v<T>, sizeof(T) < sizeof(std::int64_t)>
+        = cereal::traits::sfinae>
+    void loadValue(T& value)
+    {
+        value = static_cast<T>(next().GetInt());
+    }
+
+    template<class T, cereal::traits::EnableIf<
+        std::is_unsigned_v<T>, sizeof(T) < sizeof(std::uint64_t),
+        !std::is_same_v<bool, T>> = cereal::traits::sfinae>
+    void loadValue(T& value)
+    {
+        value = static_cast<T>(next().GetUint());
+    }
+
+    void loadValue(bool& value)          { value = next().GetBool(); }
+    void loadValue(std::int64_t& value)  { value = next().GetInt64(); }
+    void loadValue(std::uint64_t& value) { value = next().GetUint64(); }
+    void loadValue(double& value)        { value = next().GetDouble(); }
+
+    void loadValue(float& value)
+    {
+        value = static_cast<float>(next().GetDouble());
+    }
+
+    void loadValue(std::string& value)
+    {
+        auto const& string = next();
+        value.assign(string.GetString(), string.GetStringLength());
+    }
+
+    void loadValue(std::nullptr_t&)
+    {
+        CEREAL_RAPIDJSON_ASSERT(next().IsNull());
+    }
+
+    /// Load a long (unsigned long) if it would not be caught otherwise
+    template<class T, cereal::traits::EnableIf<
+        std::is_same_v<T, long> || std::is_same_v<T, unsigned long>,
+        !std::is_same_v<T, std::int32_t>,
+        !std::is_same_v<T, std::int64_t>,
+        !std::is_same_v<T, std::uint32_t>,
+        !std::is_same_v<T, std::uint64_t>> = cereal::traits::sfinae>
+    void loadValue(T& value)
+    {
+        if constexpr (std::is_signed_v<T>) {
+            value = static_cast<T>(next().GetInt64());
+        } else {
+            value = static_cast<T>(next().GetUint64());
+        }
+    }
+
+    /// Load exotic arithmetic (e.g. long double), saved as strings
+    template<class T, cereal::traits::EnableIf<
+        std::is_arithmetic_v<T>,
+        !std::is_same_v<T, long>,
+        !std::is_same_v<T, unsigned long>,
+        !std::is_same_v<T, std::int64_t>,
+        !std::is_same_v<T, std::uint64_t>,
+        (sizeof(T) >= sizeof(long double) || sizeof(T) >= sizeof(long long))>
+        = cereal::traits::sfinae>
+    void loadValue(T& value)
+    {
+        std::string encoded;
+        loadValue(encoded);
+        if constexpr (std::is_floating_point_v<T>) {
+            value = static_cast<T>(std::stold(encoded));
+        } else if constexpr (std::is_signed_v<T>) {
+            value = static_cast<T>(std::stoll(encoded));
+        } else {
+            value = static_cast<T>(std::stoull(encoded));
+        }
+    }
+
+    /// Loads the size for a SizeTag
+    void loadSize(cereal::size_type& size)
+    {
+        size = iterators_.size() == 1 ? root_.Size() :
+               (iterators_.rbegin() + 1)->value().Size();
+    }
+    /// @}
+
+private:
+    /// Move to the node named by an NVP, if it is not the next one
+    void search()
+    {
+        if (nextName_) {
+            auto const actualName = iterators_.back().name();
+            if (!actualName || std::strcmp(nextName_, actualName) != 0) {
+                iterators_.back().search(nextName_);
+            }
+        }
+        nextName_ = nullptr;
+    }
+
+    /// The value of the next node
+    JSONValue const& next()
+    {
+        search();
+        auto const& value = iterators_.back().value();
+        ++iterators_.back();
+        return value;
+    }
+
+    JSONValue const& root_;
+    char const* nextName_ = nullptr;  ///< Set by an NVP
+    std::vector<Iterator> iterators_; ///< A stack of nodes being loaded
+};
+
+// [cereal prologue/epilogue and load functions] ---------------------- begin
+// The same as cereal's for the JSONInputArchive (found by ADL)
+
+/// NVPs do not start or finish nodes - they just set up the names
+template<class T>
+void prologue(JSONValueInputArchive&, cereal::NameValuePair<T> const&) { }
+
+template<class T>
+void epilogue(JSONValueInputArchive&, cereal::NameValuePair<T> const&) { }
+
+/// SizeTags are strictly ignored for JSON
+template<class T>
+void prologue(JSONValueInputArchive&, cereal::SizeTag<T> const&) { }
+
+template<class T>
+void epilogue(JSONValueInputArchive&, cereal::SizeTag<T> const&) { }
+
+/// Other types (except minimal ones) start and finish a node
+template<class T, cereal::traits::EnableIf<
+    !std::is_arithmetic_v<T>,
+    !cereal::traits::has_minimal_base_class_serialization<T,
+        cereal::traits::has_minimal_input_serialization,
+        JSONValueInputArchive>::value,
+    !cereal::traits::has_minimal_input_serialization<T,
+        JSONValueInputArchive>::value> = cereal::traits::sfinae>
+void prologue(JSONValueInputArchive& ar, T const&)
+{
+    ar.startNode();
+}
+
+template<class T, cereal::traits::EnableIf<
+    !std::is_arithmetic_v<T>,
+    !cereal::traits::has_minimal_base_class_serialization<T,
+        cereal::traits::has_minimal_input_serialization,
+        JSONValueInputArchive>::value,
+    !cereal::traits::has_minimal_input_serialization<T,
+        JSONValueInputArchive>::value> = cereal::traits::sfinae>
+void epilogue(JSONValueInputArchive& ar, T const&)
+{
+    ar.finishNode();
+}
+
+inline void prologue(JSONValueInputArchive&, std::nullptr_t const&) { }
+inline void epilogue(JSONValueInputArchive&, std::nullptr_t const&) { }
+
+template<class T, cereal::traits::EnableIf<std::is_arithmetic_v<T>>
+    = cereal::traits::sfinae>
+void prologue(JSONValueInputArchive&, T const&) { }
+
+template<class T, cereal::traits::EnableIf<std::is_arithmetic_v<T>>
+    = cereal::traits::sfinae>
+void epilogue(JSONValueInputArchive&, T const&) { }
+
+template<class CharT, class Traits, class Alloc>
+void prologue(JSONValueInputArchive&,
+              std::basic_string<CharT, Traits, Alloc> const&) { }
+
+template<class CharT, class Traits, class Alloc>
+void epilogue(JSONValueInputArchive&,
+              std::basic_string<CharT, Traits, Alloc> const&) { }
+
+template<class T>
+void CEREAL_LOAD_FUNCTION_NAME(JSONValueInputArchive& ar,
+                               cereal::NameValuePair<T>& t)
+{
+    ar.setNextName(t.name);
+    ar(t.value);
+}
+
+inline void CEREAL_LOAD_FUNCTION_NAME(JSONValueInputArchive& ar,
+                                      std::nullptr_t& t)
+{
+    ar.loadValue(t);
+}
+
+template<class T, cereal::traits::EnableIf<std::is_arithmetic_v<T>>
+    = cereal::traits::sfinae>
+void CEREAL_LOAD_FUNCTION_NAME(JSONValueInputArchive& ar, T& t)
+{
+    ar.loadValue(t);
+}
+
+template<class CharT, class Traits, class Alloc>
+void CEREAL_LOAD_FUNCTION_NAME(JSONValueInputArchive& ar,
+    std::basic_string<CharT, Traits, Alloc>& str)
+{
+    ar.loadValue(str);
+}
+
+template<class T>
+void CEREAL_LOAD_FUNCTION_NAME(JSONValueInputArchive& ar,
+                               cereal::SizeTag<T>& st)
+{
+    ar.loadSize(st.size);
+}
+// [cereal prologue/epilogue and load functions] ------------------------ end
+
+ADAPTIV_SERIALIZATION_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+// Register the archive for polymorphic support
+CEREAL_REGISTER_ARCHIVE(adaptiv::serialization::JSONValueInputArchive)
+
+// Written with the JSONOutputArchive (which keeps its own input archive)
+namespace cereal { namespace traits { namespace detail {
+template<>
+struct get_output_from_input<adaptiv::serialization::JSONValueInputArchive>
+{ using type = cereal::JSONOutputArchive; };
+} } } // namespace cereal::traits::detail
+
+#endif //ADAPTIV_JSON_VALUE_HPP
@@ -8,11 +8,20 @@
 #ifndef ADAPTIV_SERIALIZATION_MACROS_HPP
 #define ADAPTIV_SERIALIZATION_MACROS_HPP
 
+#include <tuple>
+
 #include <boost/preprocessor.hpp>
 
 // detail: register class members for archival
 #define ADAPTIV_ARCHIVE_ELEM_impl(r, data, elem) CEREAL_NVP(elem)
 
+// detail: hand class members, with their name, to a visitor
+#define ADAPTIV_VISIT_ELEM_impl(r, data, elem) \
+    visitor(BOOST_PP_STRINGIZE(elem), elem);
+
+// detail: the type of class members
+#define ADAPTIV_TYPE_ELEM_impl(r, data, elem) decltype(elem)
+
 /**
  * @note Make class members serializable using cereal's facilities.
  * @details This macro adds the simple serialization method bellow and
@@ -25,6 +34,18 @@
  *          archive(member1, member2, ...);
  *     }
  * @endcode
+ * The same list of members is also made available to serializers that do
+ * without cereal (e.g. serialization::DirectJSONWriter):
+ * @code
+ *     template<class Visitor>
+ *     void visitMembers(Visitor& visitor) const
+ *     {
+ *          visitor("member1", member1); visitor("member2", member2); ...
+ *     }
+ *
+ *     using serialized_members_t = std::tuple<decltype(member1), ...>;
+ * @endcode
+ * @note Use the macro after declaring the members
  */
 #define ADAPTIV_SERIALIZE(...)                          \
 template<class Archive>                                 \
@@ -38,6 +59,23 @@ void serialize(Archive& archive)                        \
                 BOOST_PP_VARIADIC_TO_SEQ(__VA_ARGS__))) \
                                                         \
     );                                                  \
-} struct {}                                             \
+}                                                       \
+                                                        \
+template<class Visitor>                                 \
+void visitMembers(Visitor& visitor) const               \
+{                                                       \
+    BOOST_PP_SEQ_FOR_EACH(                              \
+        ADAPTIV_VISIT_ELEM_impl,                        \
+        data,                                           \
+        BOOST_PP_VARIADIC_TO_SEQ(__VA_ARGS__))          \
+}                                                       \
+                                                        \
+using serialized_members_t = std::tuple<                \
+    BOOST_PP_SEQ_ENUM(                                  \
+        BOOST_PP_SEQ_TRANSFORM(                         \
+            ADAPTIV_TYPE_ELEM_impl,                     \
+            data,                                       \
+            BOOST_PP_VARIADIC_TO_SEQ(__VA_ARGS__)))>;   \
+struct {}                                               \
 
 #endif //ADAPTIV_SERIALIZATION_MACROS_HPP
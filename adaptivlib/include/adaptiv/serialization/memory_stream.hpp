@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_MEMORY_STREAM_HPP
+#define ADAPTIV_MEMORY_STREAM_HPP
+
+#include <cstddef>
+#include <istream>
+#include <streambuf>
+
+#include <adaptiv/macros.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_SERIALIZATION_NAMESPACE_BEGIN
+
+/**
+ * A read-only stream buffer over memory owned by someone else, e.g. a
+ * received frame, so that it can be read with std::istream (cereal's
+ * archives) without copying it into a std::istringstream
+ * @note The memory must outlive the buffer
+ */
+class MemoryStreamBuffer : public std::streambuf
+{
+public:
+    MemoryStreamBuffer(char const* data, std::size_t size)
+    {
+        // The get area is never written to
+        auto begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+
+protected:
+    pos_type seekoff(
+        off_type offset,
+        std::ios_base::seekdir direction,
+        std::ios_base::openmode which) override
+    {
+        if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+
+        auto const base = direction == std::ios_base::beg ? eback() :
+                          direction == std::ios_base::cur ? gptr() : egptr();
+        auto const position = base + offset;
+        if (position < eback() || position > egptr()) {
+            return pos_type(off_type(-1));
+        }
+
+        setg(eback(), position, egptr());
+        return pos_type(position - eback());
+    }
+
+    pos_type seekpos(pos_type position, std::ios_base::openmode which) override
+    {
+        return seekoff(off_type(position), std::ios_base::beg, which);
+    }
+};
+
+/// An input stream over memory owned by someone else \see MemoryStreamBuffer
+class MemoryInputStream
+    : private MemoryStreamBuffer
+    , public std::istream
+{
+public:
+    MemoryInputStream(char const* data, std::size_t size)
+    : MemoryStreamBuffer(data, size)
+    , std::istream(static_cast<MemoryStreamBuffer*>(this))
+    { }
+
+    MemoryInputStream(MemoryInputStream const&) = delete;
+    MemoryInputStream& operator=(MemoryInputStream const&) = delete;
+};
+
+ADAPTIV_SERIALIZATION_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_MEMORY_STREAM_HPP
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#include <stdexcept>
+
+#include <adaptiv/net/deflate.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_NET_NAMESPACE_BEGIN
+
+std::size_t toUnsigned(std::string const& name, std::string const& value)
+{
+    try {
+        std::size_t end = 0;
+        auto result = std::stoul(value, &end);
+        if (end == value.size() && value.front() != '-') return result;
+    } catch (std::exception const&) { }
+
+    throw std::invalid_argument(
+        "option '--" + name + "' requires an unsigned integer");
+}
+
+int toBounded(std::string const& name, std::string const& value,
+              int min, int max)
+{
+    auto const result = toUnsigned(name, value);
+    if (result < static_cast<std::size_t>(min) ||
+        result > static_cast<std::size_t>(max)) {
+        throw std::invalid_argument("option '--" + name + "' must be in [" +
+            std::to_string(min) + ", " + std::to_string(max) + "]");
+    }
+    return static_cast<int>(result);
+}
+
+bool parseDeflateOption(
+    DeflateOptions& options,
+    std::string const& name,
+    std::string const& value)
+{
+    if (name == "deflate") {
+        if (value != "on" && value != "off") {
+            throw std::invalid_argument(
+                "option '--deflate' must be on or off");
+        }
+        options.enable = value == "on";
+    } else if (name == "deflate-window-bits") {
+        // zlib does not support 8 bit windows in raw deflate
+        options.windowBits = toBounded(name, value, 9, 15);
+    } else if (name == "deflate-mem-level") {
+        options.memLevel = toBounded(name, value, 1, 9);
+    } else if (name == "deflate-threshold") {
+        // Otherwise Beast compresses every message regardless
+        if (!hasDeflateThreshold) {
+            throw std::invalid_argument("option '--deflate-threshold' "
+                "requires Boost 1.75 or later");
+        }
+        options.threshold = toUnsigned(name, value);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string deflateUsage()
+{
+    return
+        "         --deflate=<on|off>\n"
+        "                         permessage-deflate compression "
+        "(default: off)\n"
+        "         --deflate-window-bits=<9-15>\n"
+        "                         compression window (default: 15)\n"
+        "         --deflate-mem-level=<1-9>\n"
+        "                         compression memory level (default: 4)\n"
+        "         --deflate-threshold=<n>\n"
+        "                         smallest message to compress, in bytes\n"
+        "                         (default: 0; requires Boost 1.75)\n";
+}
+
+ADAPTIV_NET_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
@@ -5,15 +5,30 @@
  * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
  * http://www.boost.org/LICENSE_1_0.txt)
  */
+#include <algorithm>
 #include <vector>
+#include <string>
 #include <sstream>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/core/buffers_prefix.hpp>
 
 #include <adaptiv/cloud/protocol/protocol.hpp>
+#include <adaptiv/cloud/protocol/inbound.hpp>
+#include <adaptiv/cloud/protocol/router.hpp>
+#include <adaptiv/cloud/protocol/schema.hpp>
+#include <adaptiv/cloud/protocol/fields.hpp>
 #include <adaptiv/serialization/external/cereal/types/vector.hpp>
 #include <adaptiv/serialization/external/cereal/types/memory.hpp>
 
 #include <adaptiv/cloud/protocol/messages/date_time.hpp>
+#include <adaptiv/cloud/protocol/messages/rans.hpp>
+#include <adaptiv/serialization/direct_json.hpp>
 
 #include <tests/testing.hpp>
 
@@ -135,3 +150,495 @@ TEST(Protocol, Response)
         inResp.message().residuals.momZ);
     ASSERT_EQ(outResp.message().error, inResp.message().error);
 }
+
+TEST(Protocol, Binary)
+{
+    SolveResult result {7, {0.32, 3.14, 1.41}, "none"};
+    protocol::Response outResp("solve", result);
+
+    // Simulate sending...
+    auto in = outResp.binary();
+    ASSERT_LT(in.size(), outResp.json().size());
+    ASSERT_EQ(protocol::target(in, protocol::Format::binary), "solve");
+
+    protocol::Response<SolveResult> inResp(in, protocol::Format::binary);
+
+    // Check the reconstruction was exact
+    ASSERT_EQ(inResp.target(), "solve");
+    ASSERT_EQ(inResp.message().iteration, result.iteration);
+    ASSERT_EQ(inResp.message().residuals.momX, result.residuals.momX);
+    ASSERT_EQ(inResp.message().residuals.momY, result.residuals.momY);
+    ASSERT_EQ(inResp.message().residuals.momZ, result.residuals.momZ);
+    ASSERT_EQ(inResp.message().error, result.error);
+
+    // A binary batch holds the exchanges back to back
+    std::istringstream batch(in + outResp.encode(protocol::Format::binary));
+    std::size_t count = 0;
+    while (batch.peek() != std::istringstream::traits_type::eof()) {
+        protocol::Response<SolveResult> item(batch, protocol::Format::binary);
+        ASSERT_EQ(item.message().iteration, result.iteration);
+        ++count;
+    }
+    ASSERT_EQ(count, 2u);
+
+    // Sizes the frame can not hold are rejected before they are allocated
+    std::uint64_t const huge = std::uint64_t(1) << 31;
+    std::string forged(1, '\x01');
+    forged.append(reinterpret_cast<char const*>(&huge), sizeof(huge));
+    protocol::Inbound inbound(
+        std::string_view(forged), protocol::Format::binary);
+    ASSERT_TRUE(inbound.header().target.empty());
+    ASSERT_THROW(inbound.read<protocol::Response<SolveResult>>(),
+                 std::exception);
+    ASSERT_THROW(protocol::Response<SolveResult>(
+        in.substr(0, in.size() - 1), protocol::Format::binary), std::exception);
+}
+
+TEST(Protocol, Negotiate)
+{
+    using protocol::Format;
+
+    ASSERT_EQ(protocol::negotiate("adaptiv.binary, adaptiv.json"),
+              Format::binary);
+    ASSERT_EQ(protocol::negotiate("chat ,adaptiv.json,adaptiv.binary"),
+              Format::json);
+    ASSERT_EQ(protocol::negotiate(protocol::subprotocol(Format::binary)),
+              Format::binary);
+    ASSERT_FALSE(protocol::negotiate("").has_value());
+    ASSERT_FALSE(protocol::negotiate("chat, superchat").has_value());
+}
+
+TEST(Protocol, CompactJSON)
+{
+    SolveResult result {12, {0.123456789012, 3.14e-9, 0.1}, ""};
+    protocol::Response outResp("solve", result);
+
+    auto const pretty = outResp.json();
+    auto const lossless = outResp.json({true});
+    auto const compact = outResp.json({true, 6});
+
+    // No whitespace, fewer digits
+    ASSERT_EQ(compact.find_first_of(" \n\t"), std::string::npos);
+    ASSERT_LT(lossless.size(), pretty.size());
+    ASSERT_LT(compact.size(), lossless.size());
+    ASSERT_EQ(protocol::target(compact), "solve");
+
+    // Lossless by default
+    protocol::Response<SolveResult> inLossless(lossless);
+    ASSERT_EQ(inLossless.message().residuals.momX, result.residuals.momX);
+    ASSERT_EQ(inLossless.message().residuals.momY, result.residuals.momY);
+    ASSERT_EQ(inLossless.message().residuals.momZ, result.residuals.momZ);
+
+    // Significant digits: small residuals keep their precision
+    protocol::Response<SolveResult> inResp(compact);
+    ASSERT_EQ(inResp.message().iteration, result.iteration);
+    ASSERT_NEAR(inResp.message().residuals.momX, 0.123457, 1e-12);
+    ASSERT_NEAR(inResp.message().residuals.momY, 3.14e-9, 1e-20);
+    ASSERT_EQ(inResp.message().residuals.momZ, 0.1);
+    ASSERT_EQ(inResp.message().error, result.error);
+
+    // Same as the pretty output once whitespace is removed
+    std::vector<std::string> const numbers = {"yi", "er", "san"};
+    protocol::Request outReq("solve", SolveParams{"RANS", 32, numbers});
+    auto expected = outReq.json();
+    std::string stripped;
+    bool inString = false;
+    for (auto c : expected) {
+        if (c == '"') inString = !inString;
+        if (inString || (c != ' ' && c != '\n')) stripped += c;
+    }
+    ASSERT_EQ(outReq.json({true}), stripped);
+}
+
+TEST(Protocol, Id)
+{
+    using protocol::Format;
+
+    std::vector<std::string> const numbers = {"yi", "er", "san"};
+    protocol::Request outReq("solve", SolveParams{"RANS", 32, numbers}, 42);
+    ASSERT_EQ(outReq.id(), 42u);
+
+    // Peek the header in both formats, then reconstruct
+    for (auto format : {Format::json, Format::binary}) {
+        auto in = outReq.encode(format);
+
+        auto const header = protocol::header(in, format);
+        ASSERT_EQ(header.target, "solve");
+        ASSERT_EQ(header.id, 42u);
+
+        protocol::Request<SolveParams> inReq(in, format);
+        ASSERT_EQ(inReq.id(), outReq.id());
+        ASSERT_EQ(inReq.message().maxIterations, 32u);
+    }
+
+    // The response answers the request, unsolicited ones have no id
+    SolveResult result {1, {0.1, 0.2, 0.3}, ""};
+    protocol::Response outResp("solve", result, outReq.id());
+    ASSERT_EQ(protocol::header(outResp.json({true})).id, outReq.id());
+    ASSERT_EQ(protocol::Response("solve", result).id(), protocol::unsolicited);
+
+    // Not a NetworkExchange, e.g. a plain text command
+    ASSERT_TRUE(protocol::header("solve").target.empty());
+    ASSERT_TRUE(protocol::header("[]").target.empty());
+    ASSERT_TRUE(protocol::header("solve", Format::binary).target.empty());
+}
+
+TEST(Protocol, RequestBatch)
+{
+    using protocol::Format;
+
+    std::vector<std::string> const numbers = {"yi", "er", "san"};
+    std::string binary;
+    for (protocol::id_t id = 1; id <= 3; ++id) {
+        protocol::Request request("solve", SolveParams{"RANS", id, numbers}, id);
+        binary += request.binary();
+    }
+
+    // The header of the next request is peeked from the stream
+    std::istringstream in(binary);
+    for (protocol::id_t id = 1; id <= 3; ++id) {
+        auto const header = protocol::header(in);
+        ASSERT_EQ(header.id, id);
+
+        protocol::Request<SolveParams> inReq(in, Format::binary);
+        ASSERT_EQ(inReq.id(), id);
+    }
+    ASSERT_EQ(in.peek(), std::istringstream::traits_type::eof());
+    ASSERT_TRUE(protocol::header(in).target.empty());
+}
+
+TEST(Protocol, Inbound)
+{
+    using protocol::Format;
+
+    // Simulate receiving a frame into a buffer
+    auto receive = [](boost::beast::flat_buffer& buffer, std::string const& in)
+    {
+        buffer.clear();
+        auto const size = boost::asio::buffer_copy(
+            buffer.prepare(in.size()), boost::asio::buffer(in));
+        buffer.commit(size);
+    };
+
+    std::vector<std::string> const numbers = {"yi", "er", "san"};
+    std::vector<std::string> json;
+    std::string binary;
+    for (protocol::id_t id = 1; id <= 3; ++id) {
+        protocol::Request request("solve", SolveParams{"RANS", id, numbers}, id);
+        json.push_back(request.json());
+        binary += request.binary();
+    }
+    json[1] = protocol::Request("other", SolveParams{}, 2).json({true});
+
+    boost::beast::flat_buffer buffer;
+    for (auto format : {Format::json, Format::binary}) {
+        // A single exchange, parsed in situ
+        receive(buffer, format == Format::json ? json.front()
+                                               : protocol::Request(
+            "solve", SolveParams{"RANS", 1, numbers}, 1).binary());
+        protocol::Inbound single(buffer, format);
+        ASSERT_FALSE(single.isBatch());
+        ASSERT_EQ(single.header().target, "solve");
+        ASSERT_EQ(single.header().id, 1u);
+
+        auto request = single.read<protocol::Request<SolveParams>>();
+        ASSERT_TRUE(single.done());
+        ASSERT_EQ(request.message().solver, "RANS");
+
+        // Take the message, it is no longer needed in the request
+        auto message = std::move(request).message();
+        ADAPTIV_ASSERT_ELEMENTS_EQ(message.numbers, numbers);
+    }
+
+    // A batch: skip the exchanges of an unknown target
+    receive(buffer, protocol::batch(json));
+    protocol::Inbound batch(buffer, Format::json);
+    ASSERT_TRUE(batch.isBatch());
+
+    std::vector<protocol::id_t> ids;
+    while (!batch.done()) {
+        if (batch.header().target != "solve") {
+            ASSERT_TRUE(batch.skip());
+            continue;
+        }
+        auto request = batch.read<protocol::Request<SolveParams>>();
+        ASSERT_EQ(request.message().maxIterations, request.id());
+        ids.push_back(request.id());
+    }
+    ASSERT_EQ(ids, (std::vector<protocol::id_t>{1, 3}));
+
+    // Binary exchanges back to back, read-only
+    protocol::Inbound stream(binary, Format::binary);
+    for (protocol::id_t id = 1; id <= 3; ++id) {
+        ASSERT_EQ(stream.header().id, id);
+        ASSERT_EQ(stream.read<protocol::Request<SolveParams>>().id(), id);
+    }
+    ASSERT_TRUE(stream.done());
+
+    // Not a NetworkExchange
+    protocol::Inbound text(std::string_view("solve"), Format::json);
+    ASSERT_FALSE(text.done());
+    ASSERT_TRUE(text.header().target.empty());
+    ASSERT_THROW(text.read<protocol::Request<SolveParams>>(), std::exception);
+    ASSERT_TRUE(text.done());
+}
+
+TEST(Protocol, DirectJSON)
+{
+    using adaptiv::serialization::traits::is_direct_json_serializable_v;
+    using Format = protocol::Format;
+
+    // Only classes listing their members with ADAPTIV_SERIALIZE
+    ASSERT_FALSE(is_direct_json_serializable_v<SolveParams>);
+    ASSERT_TRUE(is_direct_json_serializable_v<protocol::RANSResponse>);
+    ASSERT_TRUE(is_direct_json_serializable_v<
+        protocol::NetworkExchange<protocol::responses::DateTime>>);
+
+    protocol::RANSResponse result {
+        12,
+        {{0.123456789012, 3.14e-9, 0.1},
+         std::numeric_limits<double>::infinity(), 1e300, 1},
+        true,
+        "\"quoted\"\n\\ \x01 caf\xc3\xa9"
+    };
+    protocol::Response outResp("solve", result, 7);
+
+    // The same output as cereal, through the CompactJSONOutputArchive
+    for (int precision : {0, 6}) {
+        std::ostringstream expected;
+        {
+            adaptiv::serialization::CompactJSONOutputArchive oarchive(
+                expected, precision);
+            oarchive(cereal::make_nvp("response",
+                static_cast<protocol::NetworkExchange<
+                    protocol::RANSResponse>&>(outResp)));
+        }
+        ASSERT_EQ(outResp.json({true, precision}), expected.str());
+    }
+
+    // Appended to a buffer about to be written, and read back
+    boost::beast::flat_buffer buffer;
+    outResp.appendJSON(buffer);
+    protocol::Inbound inbound(buffer, Format::json);
+    auto inResp = inbound.read<protocol::Response<protocol::RANSResponse>>();
+    ASSERT_EQ(inResp.id(), 7);
+    ASSERT_EQ(inResp.message().iteration, result.iteration);
+    ASSERT_EQ(inResp.message().residuals.momentum.x,
+              result.residuals.momentum.x);
+    ASSERT_EQ(inResp.message().residuals.energy, result.residuals.energy);
+    ASSERT_EQ(inResp.message().residuals.tke, result.residuals.tke);
+    ASSERT_EQ(inResp.message().error, result.error);
+}
+
+namespace {
+struct Solver
+{
+    std::vector<std::size_t> iterations;
+
+    std::string onSolve(protocol::Request<SolveParams> const& request)
+    {
+        iterations.push_back(request.message().maxIterations);
+        return request.message().solver;
+    }
+
+    std::string onResult(protocol::Response<SolveResult> const& response)
+    {
+        return response.message().error;
+    }
+};
+
+std::size_t onCount(std::size_t& count, protocol::Request<SolveParams>)
+{
+    return ++count;
+}
+} // namespace
+
+TEST(Protocol, Router)
+{
+    using Format = protocol::Format;
+
+    static constexpr auto router = protocol::makeRouter(
+        protocol::route("solve",  &Solver::onSolve),
+        protocol::route("result", &Solver::onResult));
+
+    // Looked up at compile time
+    static_assert(router.find("solve") == 0);
+    static_assert(router.find("result") == 1);
+    static_assert(router.find("status") == router.npos);
+    static_assert(router.find("") == router.npos);
+    static_assert(protocol::traits::is_handler_v<decltype(&onCount)>);
+    static_assert(!protocol::traits::is_handler_v<int>);
+
+    // The message type follows from the handler of each target
+    std::vector<std::string> json;
+    json.push_back(protocol::Request(
+        "solve", SolveParams{"RANS", 1, {}}).json({true}));
+    json.push_back(protocol::Response(
+        "result", SolveResult{2, {}, "diverged"}).json({true}));
+    json.push_back(protocol::Request(
+        "other", SolveParams{"RANS", 3, {}}).json({true}));
+    json.push_back(protocol::Request(
+        "solve", SolveParams{"LES", 4, {}}).json({true}));
+    auto frame = protocol::batch(json);
+
+    Solver solver;
+    std::vector<std::string> replies;
+    protocol::Inbound inbound(std::string_view(frame), Format::json);
+    while (!inbound.done()) {
+        auto reply = router.dispatch(inbound, &solver);
+        if (!reply) {
+            ASSERT_EQ(inbound.header().target, "other");
+            ASSERT_TRUE(inbound.skip());
+            continue;
+        }
+        replies.push_back(*reply);
+    }
+    ASSERT_EQ(replies, (std::vector<std::string>{"RANS", "diverged", "LES"}));
+    ASSERT_EQ(solver.iterations, (std::vector<std::size_t>{1, 4}));
+
+    // A target with the wrong message
+    auto const result = protocol::Request(
+        "result", SolveParams{"RANS", 5, {}}).binary();
+    protocol::Inbound mismatch(std::string_view(result), Format::binary);
+    ASSERT_THROW(router.dispatch(mismatch, &solver), std::exception);
+
+    // Free functions, with arguments before the NetworkExchange
+    std::size_t count = 0;
+    auto const counter = protocol::makeRouter(
+        protocol::route("solve", &onCount));
+    auto const request = protocol::Request(
+        "solve", SolveParams{"RANS", 6, {}}).binary();
+    protocol::Inbound single(std::string_view(request), Format::binary);
+    ASSERT_EQ(counter.dispatch(single, count), 1);
+    ASSERT_EQ(count, 1);
+
+    ASSERT_THROW(
+        protocol::makeRouter(
+            protocol::route("solve", &onCount),
+            protocol::route("solve", &onCount)),
+        std::invalid_argument);
+}
+
+TEST(Protocol, Schema)
+{
+    using Format = protocol::Format;
+    using Result = protocol::Response<protocol::RANSResponse>;
+
+    protocol::RANSResponse result{};
+    result.iteration = 7;
+    result.busy = true;
+    auto const valid = protocol::Response("result", result).json({true});
+
+    auto check = [](std::string const& json) {
+        protocol::Inbound inbound(std::string_view(json), Format::json);
+        return inbound.check<Result>();
+    };
+    ASSERT_EQ(check(valid), "");
+
+    // The exact member at fault
+    auto wrongType = valid;
+    wrongType.replace(wrongType.find("7"), 1, "\"7\"");
+    ASSERT_EQ(check(wrongType), "type at #/response/message/iteration");
+
+    auto negative = valid;
+    negative.replace(negative.find("7"), 1, "-7");
+    ASSERT_EQ(check(negative), "minimum at #/response/message/iteration");
+
+    auto missing = valid;
+    missing.replace(missing.find("\"busy\":true"), 11, "\"other\":1");
+    ASSERT_EQ(check(missing), "required at #/response/message");
+
+    ASSERT_EQ(check(R"({"request":{"target":"result","id":1}})"),
+              "required at #");
+    ASSERT_EQ(check("not json"), "type at #");
+
+    // Routed targets are validated against the schema of their handler
+    static constexpr auto router = protocol::makeRouter(
+        protocol::route("result", &Solver::onResult));
+    auto const unknown = protocol::Request(
+        "other", SolveParams{"RANS", 1, {}}).json({true});
+    protocol::Inbound other(std::string_view(unknown), Format::json);
+    ASSERT_EQ(router.validate(other), "");
+
+    auto const request = protocol::Request(
+        "result", SolveParams{"RANS", 1, {}}).json({true});
+    protocol::Inbound mismatch(std::string_view(request), Format::json);
+    ASSERT_EQ(router.validate(mismatch), "required at #");
+
+    // Binary NetworkExchanges have no schema
+    auto const binary = protocol::Request(
+        "result", SolveParams{"RANS", 1, {}}).binary();
+    protocol::Inbound unchecked(std::string_view(binary), Format::binary);
+    ASSERT_EQ(router.validate(unchecked), "");
+}
+
+TEST(Protocol, Fields)
+{
+    using namespace protocol::fields;
+
+    std::vector<double> velocity(3 * 1000);
+    std::vector<float> pressure(1000);
+    for (std::size_t i = 0; i < velocity.size(); ++i) velocity[i] = 0.5 * i;
+    for (std::size_t i = 0; i < pressure.size(); ++i) pressure[i] = 2.0f * i;
+
+    protocol::FieldWriter writer;
+    writer.add("velocity", velocity, 3).add("pressure", pressure);
+    ASSERT_THROW(writer.add("tke", pressure.data(), 1000, 0),
+                 std::invalid_argument);
+    ASSERT_THROW(writer.add("tke", pressure, 0), std::invalid_argument);
+    auto const frame = writer.str();
+    ASSERT_EQ(frame.size(), writer.size());
+    ASSERT_TRUE(protocol::FieldReader::matches(frame));
+    ASSERT_FALSE(protocol::FieldReader::matches(
+        protocol::Request("solve", SolveParams{"RANS", 1, {}}).binary()));
+
+    // Views of the frame, aligned
+    protocol::FieldReader reader(frame);
+    ASSERT_EQ(reader.version(), version);
+    ASSERT_EQ(reader.size(), 2);
+    auto const u = reader.get<double>("velocity");
+    ASSERT_TRUE(u);
+    ASSERT_EQ(u->count(), 1000);
+    ASSERT_EQ(u->components(), 3);
+    ASSERT_EQ((*u)(999, 2), velocity.back());
+    ASSERT_TRUE(std::equal(u->begin(), u->end(), velocity.begin()));
+    auto const offset = reinterpret_cast<char const*>(u->data()) - frame.data();
+    ASSERT_TRUE(offset > 0 && offset < std::ptrdiff_t(frame.size()));
+    ASSERT_EQ(offset % alignment, 0);
+
+    auto const p = reader.get<float>("pressure");
+    ASSERT_TRUE(p && std::equal(p->begin(), p->end(), pressure.begin()));
+    ASSERT_FALSE(reader.get<double>("tke"));
+    ASSERT_THROW(reader.get<double>("pressure"), std::runtime_error);
+
+    // Misaligned frames are copied once
+    auto const shifted = " " + frame;
+    protocol::FieldReader copy(std::string_view(shifted).substr(1));
+    auto const v = copy.get<double>("velocity");
+    ASSERT_TRUE(v && std::equal(v->begin(), v->end(), velocity.begin()));
+
+    ASSERT_THROW(
+        protocol::FieldReader(std::string_view(frame).substr(1000)),
+        std::runtime_error);
+    ASSERT_THROW(
+        protocol::FieldReader(std::string_view(frame).substr(0, 6000)),
+        std::runtime_error);
+
+    // A newer writer: larger header and descriptors, and an unknown scalar
+    std::string newer(256, '\0');
+    Header const header{magic, std::uint16_t(version + 1), 32, 2, 64, 256};
+    Descriptor const known{"pressure", 2, 1, 2, 192, 16};
+    Descriptor const unknown{"future", 99, 1, 4, 208, 32};
+    double const values[]{1.5, 2.5};
+    std::memcpy(newer.data(), &header, sizeof(header));
+    std::memcpy(newer.data() + 32, &known, sizeof(known));
+    std::memcpy(newer.data() + 96, &unknown, sizeof(unknown));
+    std::memcpy(newer.data() + 192, values, sizeof(values));
+
+    protocol::FieldReader old(newer);
+    ASSERT_EQ(old.size(), 2);
+    auto const q = old.get<double>("pressure");
+    ASSERT_TRUE(q && q->size() == 2 && (*q)[1] == 2.5);
+    ASSERT_EQ(old.find("future")->scalar, 99);
+    ASSERT_THROW(old.get<double>("future"), std::runtime_error);
+}
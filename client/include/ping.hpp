@@ -8,34 +8,52 @@
 #ifndef ADAPTIV_RPC_PING_HPP
 #define ADAPTIV_RPC_PING_HPP
 
+#include <adaptiv/net/net.hpp>
+#include <adaptiv/cloud/protocol/format.hpp>
+#include <adaptiv/cloud/protocol/network_exchange.hpp>
 #include <adaptiv/cloud/protocol/messages/server_status.hpp>
 
 namespace client {
 
+namespace net = adaptiv::net;
 namespace beast = adaptiv::beast;
 namespace protocol = adaptiv::cloud::protocol;
 
 /// Remote procedure calls
 namespace rpc {
+/**
+ * The wire format the server chose during the handshake
+ * @param response The response to the WebSocket handshake
+ */
+protocol::Format negotiated(beast::websocket::response_type const& response);
+
 /**
  * Ping the server using an active WebSocket connection
  * @param websocket The TCP stream socket connected using WebSocket protocol
+ * @param id The id of the request, unique among the outstanding requests of
+ * the connection
  * @return The server status response
- * @note A prior successful WebSocket handshake is required
+ * @note A prior successful WebSocket handshake is required, with outgoing
+ * frames set to the negotiated format (i.e. binary or text)
+ * @note Other traffic received meanwhile is discarded
  */
 client::protocol::responses::ServerStatus
-ping(beast::websocket::stream<beast::tcp_stream>& websocket);
+ping(beast::websocket::stream<beast::tcp_stream>& websocket,
+     protocol::id_t id = 1);
 
 /**
  * Ping the server using a new WebSocket connection
+ * @param deflate The compression to offer (the server may decline it)
  * @return The server status response
  */
 protocol::responses::ServerStatus
-ping(std::string const& host, std::string const& port);
+ping(std::string const& host, std::string const& port,
+     net::DeflateOptions const& deflate = {});
 } // namespace rpc
 
 /// Do the client ping
-void ping(std::string const& host, std::string const& port);
+void ping(std::string const& host, std::string const& port,
+          net::DeflateOptions const& deflate = {});
 
 } // namespace client
 
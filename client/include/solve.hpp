@@ -23,12 +23,17 @@ namespace protocol = adaptiv::cloud::protocol;
 
 /// Remote procedure calls
 namespace rpc {
-/// Call target solve on the server
-void solve(std::string const& host, std::string const& port);
+/**
+ * Call target solve on the server
+ * @param deflate The compression to offer (the server may decline it)
+ */
+void solve(std::string const& host, std::string const& port,
+           net::DeflateOptions const& deflate = {});
 } // namespace rpc
 
 /// Calls target solve on the server and monitors the solution process
-void solve(std::string const& host, std::string const& port);
+void solve(std::string const& host, std::string const& port,
+           net::DeflateOptions const& deflate = {});
 
 } // namespace client
 
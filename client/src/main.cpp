@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cstdlib>
-
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #include <adaptiv/utility/input.hpp>
@@ -10,6 +11,7 @@
 #include "solve.hpp"
 #include "ping.hpp"
 
+namespace net = adaptiv::net;
 namespace traits = adaptiv::traits;
 namespace input = adaptiv::utility::input;
 using input::ParserType;
@@ -27,17 +29,40 @@ void print(std::vector<T> const& vec)
 
 int main(int argc, char** argv)
 {
+    auto const usage =
+        "  Usage: client <address> <port> [options]\n"
+        "Options:\n" + net::deflateUsage() +
+        "Example:\n"
+        "         client localhost 8080 --deflate=on\n";
+
     // Check command line arguments
-    if (argc != 3) {
-        std::cerr <<
-                  "  Usage: client <address> <port>\n" <<
-                  "Example:\n" <<
-                  "         client localhost 8080\n";
+    if (argc < 3) {
+        std::cerr << usage;
         return EXIT_FAILURE;
     }
     auto host = argv[1];
     auto port = argv[2];
 
+    // Options have the form --name=value (the same as the server's)
+    net::DeflateOptions deflate;
+    try {
+        for (int i = 3; i < argc; ++i) {
+            std::string const argument = argv[i];
+            auto const equal = argument.find('=');
+            if (argument.compare(0, 2, "--") != 0 ||
+                equal == std::string::npos ||
+                !net::parseDeflateOption(deflate,
+                                         argument.substr(2, equal - 2),
+                                         argument.substr(equal + 1))) {
+                throw std::invalid_argument(
+                    "invalid argument '" + argument + "'");
+            }
+        }
+    } catch (std::invalid_argument const& exception) {
+        std::cerr << "error: " << exception.what() << '\n' << usage;
+        return EXIT_FAILURE;
+    }
+
     client::welcomeMessage();
 
     input::LineParser parser(std::cin);
@@ -47,9 +72,9 @@ int main(int argc, char** argv)
         auto command = parser.popFront();
 
         if (command == "ping") {
-            client::ping(host, port);
+            client::ping(host, port, deflate);
         } else if (command == "solve") {
-            client::solve(host, port);
+            client::solve(host, port, deflate);
         } else if (command == "help") {
             client::help();
         }else if (command == "parsers") {
@@ -10,35 +10,65 @@
 #include <iomanip>
 
 #include <adaptiv/net/net.hpp>
-#include <adaptiv/cloud/protocol/response.hpp>
+#include <adaptiv/cloud/protocol/inbound.hpp>
 
 #include <adaptiv/definitions.hpp>
 
 #include "ping.hpp"
 
-namespace net = adaptiv::net;
-
 client::protocol::responses::ServerStatus
-client::rpc::ping(beast::websocket::stream<beast::tcp_stream>& websocket
-)
+client::rpc::ping(
+    beast::websocket::stream<beast::tcp_stream>& websocket,
+    protocol::id_t id)
 {
     beast::error_code ec;
 
+    // Outgoing frames are sent in the negotiated format
+    auto const format = websocket.binary() ? protocol::Format::binary
+                                           : protocol::Format::json;
+
+    // Ask for the status
+    auto request = protocol::Request(
+        "status", protocol::requests::ServerStatus{}, id).encode(format);
+    websocket.write(net::buffer(request), ec);
+    if(ec) adaptiv::except(ec, "write");
+
     // This buffer will hold the incoming message
     beast::flat_buffer buffer;
 
-    // Read a message into our buffer
-    websocket.read(buffer, ec);
-    if(ec) adaptiv::except(ec, "read");
+    // Skip the other traffic on the connection (e.g. the welcome message,
+    // a solve in progress) until the reply arrives
+    while (true) {
+        // Read a message into our buffer
+        buffer.clear();
+        websocket.read(buffer, ec);
+        if(ec) adaptiv::except(ec, "read");
 
-    auto in = beast::buffers_to_string(buffer.data());
-    protocol::Response<protocol::responses::ServerStatus> response(in);
+        // The frame type tells the negotiated format
+        auto const got = websocket.got_binary() ? protocol::Format::binary
+                                                : protocol::Format::json;
 
-    return response.message();
+        protocol::Inbound inbound(buffer, got);
+        if (inbound.isBatch() || inbound.header().id != id) continue;
+
+        return inbound.read<
+            protocol::Response<protocol::responses::ServerStatus>>().message();
+    }
+}
+
+client::protocol::Format
+client::rpc::negotiated(beast::websocket::response_type const& response)
+{
+    auto const name = response[beast::http::field::sec_websocket_protocol];
+    return protocol::negotiate({name.data(), name.size()})
+        .value_or(protocol::Format::json);
 }
 
 client::protocol::responses::ServerStatus
-client::rpc::ping(std::string const& host, std::string const& port)
+client::rpc::ping(
+    std::string const& host,
+    std::string const& port,
+    net::DeflateOptions const& deflate)
 {
     adaptiv::error_code ec;
 
@@ -69,6 +99,9 @@ client::rpc::ping(std::string const& host, std::string const& port)
         beast::websocket::stream_base::timeout::suggested(
             beast::role_type::client));
 
+    // Offer compression, if enabled (the server may decline it)
+    ws.set_option(net::permessageDeflate(deflate, beast::role_type::client));
+
     // Set a decorator to change the User-Agent of the handshake
     ws.set_option(beast::websocket::stream_base::decorator(
         [](beast::websocket::request_type& req)
@@ -76,12 +109,20 @@ client::rpc::ping(std::string const& host, std::string const& port)
             req.set(beast::http::field::user_agent,
                     std::string(ADAPTIV_VERSION_STRING) +
                     "-client-coro");
+
+            // Prefer the binary format, the server may only speak JSON
+            req.set(beast::http::field::sec_websocket_protocol,
+                    "adaptiv.binary, adaptiv.json");
         }));
 
     // Perform the websocket handshake
-    ws.handshake(host, "/", ec);
+    beast::websocket::response_type response;
+    ws.handshake(response, host, "/", ec);
     if(ec) adaptiv::except(ec, "handshake");
 
+    // Send requests in the format the server chose
+    ws.binary(negotiated(response) == protocol::Format::binary);
+
     auto status = ping(ws);
 
 //    // Close the WebSocket connection
@@ -91,10 +132,13 @@ client::rpc::ping(std::string const& host, std::string const& port)
     return status;
 }
 
-void client::ping(std::string const& host, std::string const& port)
+void client::ping(
+    std::string const& host,
+    std::string const& port,
+    net::DeflateOptions const& deflate)
 {
     try {
-        auto status = rpc::ping(host, port);
+        auto status = rpc::ping(host, port, deflate);
         auto largew = std::setw(2*adaptiv::def::output::fieldw);
         auto hline = std::string(2*adaptiv::def::output::fieldw, '-');
         std::cout <<
@@ -7,13 +7,16 @@
  */
 
 #include <string>
+#include <vector>
 #include <sstream>
 #include <cstddef>
 #include <stdexcept>
 
 #include <adaptiv/net/net.hpp>
-#include <adaptiv/cloud/protocol/response.hpp>
+#include <adaptiv/cloud/protocol/inbound.hpp>
+#include <adaptiv/cloud/protocol/router.hpp>
 #include <adaptiv/cloud/protocol/messages/rans.hpp>
+#include <adaptiv/cloud/protocol/messages/server_status.hpp>
 
 #include "solve.hpp"
 #include "ping.hpp"
@@ -35,7 +38,40 @@ void printIteration(
     std::cout << response;
 }
 
-void client::rpc::solve(std::string const& host, std::string const& port)
+namespace {
+/// The progress of a solve, driven by the responses of the server
+struct Solve
+{
+    protocol::id_t const id;
+    bool busy = true; // Until the acknowledgement or the last response
+
+    /// The server acknowledges the request with its status
+    void onStatus(
+        protocol::Response<protocol::responses::ServerStatus> const& response)
+    {
+        // Other status messages (e.g. the welcome) say nothing of the solve
+        if (response.id() != id) return;
+
+        auto const& ack = response.message();
+        if (!ack.error.empty()) {
+            throw std::runtime_error("solve: " + ack.error);
+        }
+        busy = ack.busy;
+    }
+
+    /// The residuals of an iteration
+    void onSolve(protocol::Response<protocol::RANSResponse> const& response)
+    {
+        printIteration(response.message(), 5);
+        busy = response.message().busy;
+    }
+};
+} // namespace
+
+void client::rpc::solve(
+    std::string const& host,
+    std::string const& port,
+    net::DeflateOptions const& deflate)
 {
     beast::error_code ec;
 
@@ -66,6 +102,9 @@ void client::rpc::solve(std::string const& host, std::string const& port)
         beast::websocket::stream_base::timeout::suggested(
             beast::role_type::client));
 
+    // Offer compression, if enabled (the server may decline it)
+    ws.set_option(net::permessageDeflate(deflate, beast::role_type::client));
+
     // Set a decorator to change the User-Agent of the handshake
     ws.set_option(beast::websocket::stream_base::decorator(
         [](beast::websocket::request_type& req)
@@ -73,37 +112,54 @@ void client::rpc::solve(std::string const& host, std::string const& port)
             req.set(beast::http::field::user_agent,
                     std::string(ADAPTIV_VERSION_STRING) +
                     "-client-coro");
+
+            // Prefer the binary format, the server may only speak JSON
+            req.set(beast::http::field::sec_websocket_protocol,
+                    "adaptiv.binary, adaptiv.json");
         }));
 
 
     // Perform the websocket handshake
-    ws.handshake(host, "/", ec);
+    beast::websocket::response_type handshake;
+    ws.handshake(handshake, host, "/", ec);
     if(ec) adaptiv::except(ec, "handshake");
 
-    // Check the server status
-    auto status = rpc::ping(ws);
+    // Send requests in the format the server chose
+    auto const format = rpc::negotiated(handshake);
+    ws.binary(format == protocol::Format::binary);
 
-    // Send the message // todo: implement solve request using NetworkExchange
-    if (!status.busy) {
-        std::string solveRequest = "solve";
-        ws.write(net::buffer(solveRequest), ec);
-        if(ec) adaptiv::except(ec, "write");
-    }
+    // Start the solver, or join the ongoing solve
+    protocol::id_t const solveId = 1;
+    auto request = protocol::Request(
+        "solve", protocol::RANSRequest{}, solveId).encode(format);
+    ws.write(net::buffer(request), ec);
+    if(ec) adaptiv::except(ec, "write");
+
+    static constexpr auto router = protocol::makeRouter(
+        protocol::route("status", &Solve::onStatus),
+        protocol::route("solve",  &Solve::onSolve));
+
+    // This buffer will hold the incoming messages
+    beast::flat_buffer buffer;
 
-    bool busy = false;
+    Solve solve{solveId};
     do {
         // Read rans response
-        beast::flat_buffer buffer;
+        buffer.clear();
         ws.read(buffer, ec);
         if (ec) adaptiv::except(ec, "read response");
 
-        auto in = beast::buffers_to_string(buffer.data());
+        // The frame type tells the negotiated format
+        auto const got = ws.got_binary() ? protocol::Format::binary
+                                         : protocol::Format::json;
 
-        protocol::Response<protocol::RANSResponse> response(in);
-        printIteration(response.message(), 5);
-
-        busy = response.message().busy;
-    } while (busy);
+        // The server may batch the solve responses
+        protocol::Inbound inbound(buffer, got);
+        while (!inbound.done()) {
+            // Skip the replies to other targets
+            if (!router.dispatch(inbound, &solve) && !inbound.skip()) break;
+        }
+    } while (solve.busy);
 
     // Close the WebSocket connection
     ws.close(beast::websocket::close_code::normal, ec);
@@ -112,10 +168,13 @@ void client::rpc::solve(std::string const& host, std::string const& port)
     // If we get here then the connection is closed gracefully
 }
 
-void client::solve(std::string const& host, std::string const& port)
+void client::solve(
+    std::string const& host,
+    std::string const& port,
+    net::DeflateOptions const& deflate)
 {
     try {
-        rpc::solve(host, port);
+        rpc::solve(host, port, deflate);
     } catch (std::exception const& exception) {
         adaptiv::fail(exception.what());
     }
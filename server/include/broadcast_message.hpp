@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_BROADCAST_MESSAGE_HPP
+#define ADAPTIV_BROADCAST_MESSAGE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <adaptiv/cloud/protocol/format.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_SERVER_NAMESPACE_BEGIN
+
+/**
+ * A message for every session, serialized on demand: the first session that
+ * needs a wire format serializes the message in it, once, and the sessions
+ * that negotiated the same format share that encoding. Formats no session
+ * uses are never serialized, and the producer (i.e. the solver) only pays for
+ * keeping the payload.
+ * @note Messages are recycled (see MessagePool): the payload is kept in place
+ * and the encodings keep their memory, so a recycled message allocates nothing
+ * @note The cache is filled by const member functions, from any thread: the
+ * message is immutable once published
+ */
+class BroadcastMessage
+{
+public:
+    /// The most bytes of an encoder (i.e. of the payload it captures)
+    static std::size_t constexpr encoderCapacity = 160;
+
+    BroadcastMessage() = default;
+
+    ~BroadcastMessage() { reset(); }
+
+    // The sessions share it: see SharedState::enqueue()
+    BroadcastMessage(BroadcastMessage const&) = delete;
+    BroadcastMessage& operator=(BroadcastMessage const&) = delete;
+
+    /**
+     * Set the payload of the message
+     * @param encoder Serializes the payload (captured by value) in a format:
+     * void (protocol::Format format, std::string& out) const, where \c out is
+     * empty but may have capacity
+     */
+    template<class Encoder>
+    void assign(Encoder encoder)
+    {
+        static_assert(sizeof(Encoder) <= encoderCapacity &&
+                      alignof(Encoder) <= alignof(std::max_align_t),
+            "[adaptiv::server::BroadcastMessage] the payload is too large");
+
+        reset();
+        ::new (static_cast<void*>(&encoder_)) Encoder(std::move(encoder));
+        encode_ = [](void const* encoder, protocol::Format format,
+                     std::string& out) {
+            (*static_cast<Encoder const*>(encoder))(format, out);
+        };
+        destroy_ = [](void* encoder) noexcept {
+            static_cast<Encoder*>(encoder)->~Encoder();
+        };
+    }
+
+    /// Drop the payload and the encodings, keeping their memory
+    void reset() noexcept
+    {
+        if (destroy_) destroy_(&encoder_);
+        encode_ = nullptr;
+        destroy_ = nullptr;
+
+        for (auto& encoding : cache_) {
+            encoding.data.clear();
+            encoding.isReady.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    /// The message serialized in \c format \note Thread-safe
+    std::string const& encoded(protocol::Format format) const
+    {
+        auto& encoding = cache_[static_cast<std::size_t>(format)];
+        if (!encoding.isReady.load(std::memory_order_acquire)) {
+            std::lock_guard guard(encoding.mutex);
+            if (!encoding.isReady.load(std::memory_order_relaxed)) {
+                encode_(&encoder_, format, encoding.data);
+                encoding.isReady.store(true, std::memory_order_release);
+            }
+        }
+        return encoding.data;
+    }
+
+private:
+    struct Encoding
+    {
+        std::mutex mutex;
+        std::atomic<bool> isReady{false};
+        std::string data;
+    };
+
+    std::aligned_storage_t<encoderCapacity, alignof(std::max_align_t)>
+        encoder_;
+    void (*encode_)(void const*, protocol::Format, std::string&) = nullptr;
+    void (*destroy_)(void*) noexcept = nullptr;
+
+    /// Indexed by protocol::Format (json, binary)
+    mutable std::array<Encoding, 2> cache_;
+};
+
+ADAPTIV_SERVER_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_BROADCAST_MESSAGE_HPP
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_BROADCAST_RING_HPP
+#define ADAPTIV_BROADCAST_RING_HPP
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <adaptiv/macros.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_SERVER_NAMESPACE_BEGIN
+
+/**
+ * A bounded single-producer/multi-consumer broadcast log.
+ * The producer writes each message once; every consumer reads the log at its
+ * own pace using a private cursor (the sequence number of the next message).
+ * Neither side takes a lock on the ring. Slots are reused, so a consumer that
+ * falls more than capacity() messages behind is told it has been lapped and
+ * must resume from oldest().
+ * @tparam Ref A counted reference to an (immutable) message, whose memory
+ * outlives the log: release(), adopt() and tryRetain() (see MessagePool::Ref)
+ * @note Each slot holds a reference to its message. A reader takes a
+ * reference of its own and then checks the slot was not reused meanwhile
+ * (seqlock): if it was, the reference it took (if any) is dropped.
+ */
+template<class Ref>
+class BroadcastRing
+{
+public:
+    using value_type = Ref;
+    using sequence_t = std::uint64_t;
+
+    /// The outcome of read()
+    enum class Status
+    {
+        ok,     ///< The message was read
+        empty,  ///< The message has not been published yet
+        lapped  ///< The message was overwritten: resume from oldest()
+    };
+
+    /// @param capacity The number of slots (rounded up to a power of two)
+    explicit BroadcastRing(std::size_t capacity)
+    : slots_(roundUp(capacity))
+    , mask_(slots_.size() - 1)
+    { }
+
+    ~BroadcastRing()
+    {
+        for (auto& slot : slots_) {
+            value_type::adopt(slot.value.load(std::memory_order_relaxed))
+                .reset();
+        }
+    }
+
+    BroadcastRing(BroadcastRing const&) = delete;
+    BroadcastRing& operator=(BroadcastRing const&) = delete;
+
+    /**
+     * Append a message to the log
+     * @return The sequence number of the message
+     * @attention Only one thread may publish
+     */
+    sequence_t publish(value_type value)
+    {
+        auto const sequence = head_.load(std::memory_order_relaxed);
+        auto& slot = slots_[sequence & mask_];
+
+        // Invalidate the slot first so that readers of the previous occupant
+        // notice it was replaced (seqlock)
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        auto const previous =
+            slot.value.exchange(value.release(), std::memory_order_relaxed);
+        slot.sequence.store(sequence, std::memory_order_release);
+
+        head_.store(sequence + 1, std::memory_order_release);
+
+        // Drop the reference of the log to the previous occupant: a reader
+        // that took one meanwhile sees the slot was reused (see read())
+        value_type::adopt(previous).reset();
+        return sequence;
+    }
+
+    /**
+     * Read the message with sequence number \c cursor
+     * @param cursor The sequence number to read
+     * @param[out] value The message (only set if the result is Status::ok)
+     */
+    Status read(sequence_t cursor, value_type& value) const
+    {
+        if (cursor >= head_.load(std::memory_order_acquire)) {
+            return Status::empty;
+        }
+
+        auto const& slot = slots_[cursor & mask_];
+        if (slot.sequence.load(std::memory_order_acquire) != cursor) {
+            return Status::lapped;
+        }
+
+        // None left: the message was dropped, so the slot was reused
+        auto candidate = value_type::tryRetain(
+            slot.value.load(std::memory_order_relaxed));
+        if (!candidate) return Status::lapped;
+
+        // The slot may have been reused while we were reading it
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != cursor) {
+            return Status::lapped;
+        }
+
+        value = std::move(candidate);
+        return Status::ok;
+    }
+
+    /// The sequence number the next message will get
+    sequence_t head() const noexcept
+    {
+        return head_.load(std::memory_order_acquire);
+    }
+
+    /// The sequence number of the oldest message that can still be read
+    sequence_t oldest() const noexcept
+    {
+        auto const head = this->head();
+        return head - first > capacity() ? head - capacity() : first;
+    }
+
+    std::size_t capacity() const noexcept { return slots_.size(); }
+
+private:
+    /// Sequence numbers start at one: a zero slot sequence means "invalid"
+    static sequence_t constexpr first = 1;
+
+    struct Slot
+    {
+        std::atomic<sequence_t> sequence{0};
+
+        /// The reference of the log to the message (given up by release())
+        std::atomic<typename value_type::handle_t> value{nullptr};
+    };
+
+    static std::size_t roundUp(std::size_t capacity)
+    {
+        std::size_t result = 1;
+        while (result < capacity) result <<= 1;
+        return result;
+    }
+
+    std::vector<Slot> slots_;
+    std::size_t const mask_;
+    std::atomic<sequence_t> head_{first};
+};
+
+ADAPTIV_SERVER_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_BROADCAST_RING_HPP
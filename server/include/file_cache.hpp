@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_FILE_CACHE_HPP
+#define ADAPTIV_FILE_CACHE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include <adaptiv/net/net.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_SERVER_NAMESPACE_BEGIN
+
+/// Return a reasonable mime type based on the extension of a file
+beast::string_view mimeType(beast::string_view path);
+
+/**
+ * The files of the document root, kept in memory: each file is read once,
+ * together with its compressed variants (gzip and deflate, for text types)
+ * and their entity tags. A file that changes on disk (i.e. its size or
+ * modification time) is read again on its next lookup.
+ * @note Files larger than a few megabytes, or that do not fit the memory
+ * budget, are not kept: the server streams them from disk
+ */
+class FileCache
+{
+public:
+    /// The content codings of a file, in order of preference
+    enum class Coding
+    {
+        identity,
+        gzip,
+        deflate
+    };
+
+    /// A representation of a file
+    struct Variant
+    {
+        std::string body; ///< Empty if the coding does not pay off
+        std::string etag; ///< A strong entity tag, quoted
+    };
+
+    /// A file, as read from disk \note Immutable: it is replaced on changes
+    struct Entry
+    {
+        beast::string_view mime;
+        std::filesystem::file_time_type modified;
+        std::uintmax_t size = 0;
+
+        /// Indexed by Coding: the identity variant is always present
+        std::array<Variant, 3> variants;
+
+        /// Compressed variants exist: responses vary on Accept-Encoding
+        bool isCompressed = false;
+
+        /**
+         * The variant to send for an Accept-Encoding field value: the
+         * preferred coding the client accepts, otherwise identity
+         */
+        Variant const& negotiate(beast::string_view acceptEncoding) const;
+
+        /// The coding of a variant of this entry
+        Coding coding(Variant const& variant) const noexcept
+        {
+            return static_cast<Coding>(&variant - variants.data());
+        }
+
+        /// The bytes kept for the entry
+        std::size_t memory() const noexcept;
+
+        /// The entry holds this version of the file
+        bool isVersion(std::filesystem::file_time_type modified,
+                       std::uintmax_t size) const noexcept
+        {
+            return this->modified == modified && this->size == size;
+        }
+    };
+
+    using entry_t = std::shared_ptr<Entry const>;
+
+    /// @param budget The most bytes kept in memory, zero disables the cache
+    explicit FileCache(std::size_t budget);
+
+    FileCache(FileCache const&) = delete;
+    FileCache& operator=(FileCache const&) = delete;
+
+    /**
+     * The cached file at \c path, read (again) if it is not cached or has
+     * changed on disk. Returns \c nullptr, without an error, if the file is
+     * not kept in memory (i.e. the caller serves it from disk)
+     * @param ec Set if the file does not exist or can not be read (then the
+     * entry, if any, is evicted)
+     * \note Thread-safe: concurrent lookups of a file that is being read
+     * wait for that read, rather than read and compress the file again
+     */
+    entry_t find(std::string const& path, error_code& ec);
+
+    /// The bytes kept in memory
+    std::size_t memory() const;
+
+    /// The name of a content coding, as in Content-Encoding
+    static beast::string_view name(Coding coding) noexcept;
+
+    /**
+     * A strong entity tag for a version of a file, quoted
+     * @param coding The content coding of the representation, if any
+     */
+    static std::string entityTag(std::uintmax_t size,
+                                 std::filesystem::file_time_type modified,
+                                 beast::string_view coding = {});
+
+    /// True if \c etag matches an If-None-Match field value
+    static bool matches(beast::string_view ifNoneMatch,
+                        beast::string_view etag);
+
+private:
+    /// Read a file and compress it
+    entry_t load(std::string const& path,
+                 std::filesystem::file_time_type modified,
+                 std::uintmax_t size,
+                 error_code& ec) const;
+
+    /**
+     * Keep a loaded entry, if it fits, and clear the read in progress. The
+     * previous entry is dropped if the read failed (i.e. \c entry is null)
+     */
+    entry_t store(std::string const& path, entry_t entry);
+
+    /// Drop the entry of a file, if any
+    void evict(std::string const& path);
+
+    std::size_t const budget_;
+
+    /// Guards the entries: lookups share it, (re)loads are exclusive
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string, entry_t> entries_;
+    std::size_t memory_ = 0;
+
+    /// The files being read, which concurrent lookups wait for (mutex_)
+    std::unordered_map<std::string, std::shared_future<entry_t>> loading_;
+};
+
+ADAPTIV_SERVER_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_FILE_CACHE_HPP
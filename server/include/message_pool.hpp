@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_MESSAGE_POOL_HPP
+#define ADAPTIV_MESSAGE_POOL_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#include <adaptiv/macros.hpp>
+
+#include "broadcast_message.hpp"
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_SERVER_NAMESPACE_BEGIN
+
+/**
+ * A slab of BroadcastMessages, recycled when their last reference is
+ * released. Each slot holds a message and its reference count (i.e. the
+ * references are intrusive), so in steady state (i.e. once the pool has as
+ * many slots as messages alive) publishing a message allocates nothing.
+ * @note Taking and recycling a slot are lock-free; only growing the pool
+ * takes a lock
+ * @note The pool grows a chunk of slots at a time and never shrinks (nor
+ * frees a slot): a stale reference to a slot is safe to count, see
+ * Ref::tryRetain()
+ * @attention The pool must outlive its messages
+ */
+class MessagePool
+{
+    struct Slot;
+
+public:
+    /**
+     * A counted reference to a message of the pool (an intrusive shared
+     * pointer): the slot is recycled when the last reference goes
+     */
+    class Ref
+    {
+    public:
+        /// A reference given up by release() \see adopt()
+        using handle_t = Slot*;
+
+        Ref() noexcept = default;
+
+        Ref(std::nullptr_t) noexcept { }
+
+        Ref(Ref const& other) noexcept
+        : slot_(other.slot_)
+        {
+            if (slot_) {
+                slot_->references.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        Ref(Ref&& other) noexcept
+        : slot_(std::exchange(other.slot_, nullptr))
+        { }
+
+        Ref& operator=(Ref other) noexcept
+        {
+            std::swap(slot_, other.slot_);
+            return *this;
+        }
+
+        ~Ref() { reset(); }
+
+        /// Drop the reference, recycling the slot if it was the last one
+        void reset() noexcept
+        {
+            auto const slot = std::exchange(slot_, nullptr);
+            if (slot && slot->references.fetch_sub(
+                    1, std::memory_order_acq_rel) == 1) {
+                slot->pool->recycle(slot);
+            }
+        }
+
+        BroadcastMessage const* get() const noexcept
+        {
+            return slot_ ? &slot_->message : nullptr;
+        }
+
+        BroadcastMessage const& operator*() const noexcept
+        {
+            return slot_->message;
+        }
+
+        BroadcastMessage const* operator->() const noexcept
+        {
+            return &slot_->message;
+        }
+
+        explicit operator bool() const noexcept { return slot_ != nullptr; }
+
+        /// Give the reference up, without dropping it
+        handle_t release() noexcept { return std::exchange(slot_, nullptr); }
+
+        /// Take over a reference given up by release()
+        static Ref adopt(handle_t handle) noexcept
+        {
+            Ref ref;
+            ref.slot_ = handle;
+            return ref;
+        }
+
+        /**
+         * A new reference to the message of a handle that is not owned by
+         * the caller, unless the message has none left (i.e. its slot is
+         * free). Lock-free: the slot may have been recycled since the handle
+         * was read, so the caller checks (after the call) that the handle
+         * was still current
+         */
+        static Ref tryRetain(handle_t handle) noexcept
+        {
+            if (!handle) return {};
+
+            auto count = handle->references.load(std::memory_order_relaxed);
+            while (count != 0) {
+                if (handle->references.compare_exchange_weak(
+                        count, count + 1,
+                        std::memory_order_acquire,
+                        std::memory_order_relaxed)) {
+                    return adopt(handle);
+                }
+            }
+            return {};
+        }
+
+    private:
+        Slot* slot_ = nullptr;
+    };
+
+    using value_type = Ref;
+
+    /// @param chunk The number of slots added whenever the pool runs out
+    explicit MessagePool(std::size_t chunk = 256)
+    : chunk_(chunk == 0 ? 1 : chunk)
+    {
+        if (chunk_ > std::numeric_limits<std::uint32_t>::max() / maxChunks) {
+            throw std::invalid_argument(
+                "[adaptiv::server::MessagePool] the chunk is too large");
+        }
+    }
+
+    MessagePool(MessagePool const&) = delete;
+    MessagePool& operator=(MessagePool const&) = delete;
+
+    /**
+     * A message, from a free slot
+     * @param encoder Serializes the payload \see BroadcastMessage::assign()
+     * \note Thread-safe
+     */
+    template<class Encoder>
+    value_type make(Encoder&& encoder)
+    {
+        auto slot = acquire();
+        try {
+            slot->message.assign(std::forward<Encoder>(encoder));
+        } catch (...) {
+            slot->message.reset();
+            release(slot);
+            throw;
+        }
+
+        // Counted from here on: a free slot has no references to take
+        slot->references.store(1, std::memory_order_release);
+        return Ref::adopt(slot);
+    }
+
+    /// The number of slots \note Thread-safe
+    std::size_t size() const noexcept
+    {
+        return chunks_.load(std::memory_order_acquire) * chunk_;
+    }
+
+private:
+    /// The most chunks the pool grows to
+    static std::size_t constexpr maxChunks = 4096;
+
+    struct Slot
+    {
+        BroadcastMessage message;
+        MessagePool* pool = nullptr;
+
+        /// The references to the message, zero while the slot is free
+        std::atomic<std::uint32_t> references{0};
+
+        /// The position of the slot in the pool, plus one
+        std::uint32_t id = 0;
+
+        /// The next free slot (its id, zero for none) while the slot is free
+        std::atomic<std::uint32_t> next{0};
+    };
+
+    /// The head of the free list after \c head, with \c id on top
+    static std::uint64_t retag(std::uint64_t head, std::uint32_t id) noexcept
+    {
+        return ((head >> 32) + 1) << 32 | id;
+    }
+
+    /// The slot with an id (the chunk of an id is never replaced)
+    Slot& slot(std::uint32_t id) noexcept
+    {
+        --id;
+        return directory_[id / chunk_][id % chunk_];
+    }
+
+    Slot* acquire()
+    {
+        if (auto slot = pop()) return slot;
+        return grow();
+    }
+
+    /// Pop a free slot, if any
+    Slot* pop() noexcept
+    {
+        auto head = free_.load(std::memory_order_acquire);
+        while (auto const id = static_cast<std::uint32_t>(head)) {
+            // The top may be taken meanwhile: then the tag has changed
+            auto& top = slot(id);
+            auto const next = top.next.load(std::memory_order_relaxed);
+            if (free_.compare_exchange_weak(head, retag(head, next),
+                                            std::memory_order_acquire,
+                                            std::memory_order_acquire)) {
+                return &top;
+            }
+        }
+        return nullptr;
+    }
+
+    /// Add a chunk of slots: the first one is the caller's, the rest free
+    Slot* grow()
+    {
+        std::lock_guard guard(mutex_);
+
+        // Another thread may have grown the pool meanwhile
+        if (auto slot = pop()) return slot;
+
+        auto const count = chunks_.load(std::memory_order_relaxed);
+        if (count == maxChunks) throw std::bad_alloc();
+
+        auto& chunk = directory_[count];
+        chunk = std::make_unique<Slot[]>(chunk_);
+        for (std::size_t i = 0; i < chunk_; ++i) {
+            chunk[i].pool = this;
+            chunk[i].id = static_cast<std::uint32_t>(count * chunk_ + i + 1);
+            if (i > 1) {
+                chunk[i - 1].next.store(chunk[i].id, std::memory_order_relaxed);
+            }
+        }
+        chunks_.store(count + 1, std::memory_order_release);
+
+        if (chunk_ > 1) push(chunk[1], chunk[chunk_ - 1]);
+        return &chunk[0];
+    }
+
+    /// Push the free slots linked from \c first to \c last
+    void push(Slot& first, Slot& last) noexcept
+    {
+        auto head = free_.load(std::memory_order_relaxed);
+        do {
+            last.next.store(static_cast<std::uint32_t>(head),
+                            std::memory_order_relaxed);
+        } while (!free_.compare_exchange_weak(head, retag(head, first.id),
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed));
+    }
+
+    /// The last reference to the message of a slot is gone
+    void recycle(Slot* slot) noexcept
+    {
+        slot->message.reset();
+        release(slot);
+    }
+
+    void release(Slot* slot) noexcept { push(*slot, *slot); }
+
+    std::size_t const chunk_;
+
+    /// Serializes growing the pool (the free list takes no lock)
+    std::mutex mutex_;
+
+    /// The chunks of slots, filled in order and kept until the pool goes
+    std::array<std::unique_ptr<Slot[]>, maxChunks> directory_;
+    std::atomic<std::size_t> chunks_{0};
+
+    /**
+     * The free list: a Treiber stack of slots, lock-free. The head holds the
+     * id of the top slot and, in its upper half, a tag that every change
+     * bumps, so that a stale head fails the compare-exchange (i.e. no ABA)
+     */
+    std::atomic<std::uint64_t> free_{0};
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+};
+
+ADAPTIV_SERVER_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_MESSAGE_POOL_HPP
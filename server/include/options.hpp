@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_SERVER_OPTIONS_HPP
+#define ADAPTIV_SERVER_OPTIONS_HPP
+
+#include <cstddef>
+#include <string>
+#include <chrono>
+
+#include <adaptiv/macros.hpp>
+#include <adaptiv/net/deflate.hpp>
+#include <adaptiv/cloud/protocol/format.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_SERVER_NAMESPACE_BEGIN
+
+/// What to do with a session that falls too far behind the broadcast log
+enum class SlowConsumerPolicy
+{
+    dropOldest, ///< Skip the oldest unsent messages
+    latest,     ///< Skip to the latest message (i.e. the latest residuals)
+    disconnect  ///< Close the connection
+};
+
+/// Runtime configuration of the server (given as --name=value arguments)
+struct Options
+{
+    /// Number of threads running the io_context
+    std::size_t threads = 1;
+
+    /**
+     * Number of shards: independent io_contexts, each run by its own thread
+     * (pinned to a core) and accepting on its own SO_REUSEPORT socket, so
+     * the kernel balances the connections and sessions stay on their shard.
+     * Zero runs a single io_context on \c threads threads
+     */
+    std::size_t shards = 0;
+
+    /// Number of messages kept in the broadcast log for slow sessions
+    std::size_t broadcastCapacity = 1024;
+
+    /**
+     * How long a session may hold back broadcast messages to send them
+     * together as a single frame (a JSON array). Zero disables coalescing
+     */
+    std::chrono::microseconds coalesceWindow{0};
+
+    /// Send a coalesced frame as soon as it holds this many bytes (at least 1)
+    std::size_t coalesceBytes = 64 * 1024;
+
+    /**
+     * The maximum number of unsent broadcast messages of a session. Zero
+     * means the limit is the capacity of the broadcast log
+     */
+    std::size_t sessionBacklog = 0;
+
+    /// Applied to sessions whose backlog exceeds the limit
+    SlowConsumerPolicy slowConsumer = SlowConsumerPolicy::dropOldest;
+
+    /// Compression of the websocket messages (permessage-deflate)
+    net::DeflateOptions deflate;
+
+    /// The layout of JSON messages: residuals only need a few digits
+    protocol::JSONStyle json{true, 6};
+
+    /**
+     * The most bytes of the document root kept in memory (see FileCache).
+     * Zero disables the cache: every file is read from disk
+     */
+    std::size_t fileCache = 64 * 1024 * 1024;
+};
+
+/**
+ * Parse the optional command line arguments of the server
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @param first The index of the first optional argument
+ * @throw std::invalid_argument If an argument is unknown or malformed
+ */
+Options parseOptions(int argc, char** argv, int first);
+
+/// The usage message for the optional command line arguments
+std::string optionsUsage();
+
+ADAPTIV_SERVER_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_SERVER_OPTIONS_HPP
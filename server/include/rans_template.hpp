@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_RANS_TEMPLATE_HPP
+#define ADAPTIV_RANS_TEMPLATE_HPP
+
+#include <array>
+#include <cstddef>
+#include <string>
+
+#include <adaptiv/macros.hpp>
+#include <adaptiv/cloud/protocol/format.hpp>
+#include <adaptiv/cloud/protocol/messages/rans.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_SERVER_NAMESPACE_BEGIN
+
+namespace solver {
+
+/**
+ * The RANS responses of a run, serialized once: every iteration only
+ * writes the numeric values (i.e. the iteration, the residuals and busy).
+ * JSON values are appended between the constant fragments of the text,
+ * binary values are written over a copy, in place. The layout is that of
+ * protocol::Response, in both wire formats.
+ * @note Responses with an error are serialized in full
+ */
+class RANSTemplate
+{
+public:
+    /**
+     * Serialize the layout of the responses
+     * @param target The target of the responses
+     * @param style The layout of the JSON format
+     */
+    RANSTemplate(std::string target, protocol::JSONStyle const& style);
+
+    /// The response, in a wire format
+    std::string encode(
+        protocol::RANSResponse const& result,
+        protocol::Format format) const;
+
+    /// Write the response in a wire format over \c out, reusing its memory
+    void encode(
+        protocol::RANSResponse const& result,
+        protocol::Format format,
+        std::string& out) const;
+
+private:
+    /// The numeric members of a RANSResponse, in order
+    static std::size_t constexpr slots = 8;
+
+    std::string const target_;
+    protocol::JSONStyle const style_;
+    int const precision_; ///< Of the residuals, 0 for the shortest
+
+    /// The JSON text before each value, and after the last one
+    std::array<std::string, slots + 1> jsonFragments_;
+    std::size_t jsonSize_ = 0; ///< Enough for any response
+
+    std::string binary_;
+    std::size_t binaryMessage_; ///< Offset of the RANSResponse
+};
+
+} // namespace solver
+
+ADAPTIV_SERVER_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_RANS_TEMPLATE_HPP
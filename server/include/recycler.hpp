@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_RECYCLER_HPP
+#define ADAPTIV_RECYCLER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <adaptiv/macros.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_SERVER_NAMESPACE_BEGIN
+
+/**
+ * Keeps the objects its handles release for the next acquire(), e.g. the
+ * read buffers of closed sessions, with the memory they grew
+ * @tparam T A default constructible type
+ * @attention The recycler must outlive its handles
+ */
+template<class T>
+class Recycler
+{
+    /// Gives the object back to the recycler
+    struct Release
+    {
+        Recycler* recycler;
+
+        void operator()(T* object) const noexcept
+        {
+            recycler->release(object);
+        }
+    };
+
+public:
+    using handle_t = std::unique_ptr<T, Release>;
+
+    /// @param capacity The most objects kept idle (the rest are destroyed)
+    explicit Recycler(std::size_t capacity)
+    : capacity_(capacity)
+    {
+        idle_.reserve(capacity_);
+    }
+
+    Recycler(Recycler const&) = delete;
+    Recycler& operator=(Recycler const&) = delete;
+
+    /// An idle object, or a new one \note Thread-safe
+    handle_t acquire()
+    {
+        {
+            std::lock_guard guard(mutex_);
+            if (!idle_.empty()) {
+                auto object = std::move(idle_.back());
+                idle_.pop_back();
+                return handle_t(object.release(), Release{this});
+            }
+        }
+        return handle_t(new T(), Release{this});
+    }
+
+private:
+    void release(T* object) noexcept
+    {
+        std::unique_ptr<T> owner(object);
+
+        std::lock_guard guard(mutex_);
+        if (idle_.size() < capacity_) idle_.push_back(std::move(owner));
+    }
+
+    std::size_t const capacity_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<T>> idle_;
+};
+
+ADAPTIV_SERVER_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_RECYCLER_HPP
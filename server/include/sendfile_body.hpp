@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#ifndef ADAPTIV_SENDFILE_BODY_HPP
+#define ADAPTIV_SENDFILE_BODY_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include <boost/optional.hpp>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <sys/sendfile.h>
+#endif
+
+#include <adaptiv/net/net.hpp>
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_SERVER_NAMESPACE_BEGIN
+
+/**
+ * An HTTP body that is a range of a file (the whole file by default). On
+ * Linux, sendFile() sends it with sendfile(2): the kernel copies the file from
+ * the page cache to the socket, so large downloads cost neither user space
+ * copies nor memory. Elsewhere, and with Beast's own write functions, the
+ * range is read in chunks (as beast::http::file_body does)
+ */
+struct SendfileBody
+{
+    class value_type
+    {
+        beast::file file_;
+        std::uint64_t fileSize_ = 0;
+        std::uint64_t offset_ = 0;
+        std::uint64_t size_ = 0;
+
+    public:
+        /// Open a file, the body is the whole file
+        void open(char const* path, error_code& ec)
+        {
+            file_.open(path, beast::file_mode::scan, ec);
+            if (ec) return;
+            fileSize_ = file_.size(ec);
+            if (ec) return file_.close(ec);
+            offset_ = 0;
+            size_ = fileSize_;
+        }
+
+        bool is_open() const { return file_.is_open(); }
+
+        /// The body is the bytes [first, last] of the file
+        void range(std::uint64_t first, std::uint64_t last)
+        {
+            offset_ = std::min(first, fileSize_);
+            size_ = std::min(last + 1, fileSize_) - offset_;
+        }
+
+        beast::file& file() noexcept { return file_; }
+
+        std::uint64_t fileSize() const noexcept { return fileSize_; }
+
+        std::uint64_t offset() const noexcept { return offset_; }
+
+        std::uint64_t size() const noexcept { return size_; }
+    };
+
+    /// The size of the body (i.e. of the range)
+    static std::uint64_t size(value_type const& body) { return body.size(); }
+
+    /// Reads the range in chunks
+    class writer
+    {
+        value_type& body_;
+        std::uint64_t remaining_;
+        std::array<char, 4096> buffer_;
+
+    public:
+        using const_buffers_type = net::const_buffer;
+
+        template<bool isRequest, class Fields>
+        writer(beast::http::header<isRequest, Fields>&, value_type& body)
+        : body_(body)
+        , remaining_(body.size())
+        { }
+
+        void init(error_code& ec)
+        {
+            body_.file().seek(body_.offset(), ec);
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>>
+        get(error_code& ec)
+        {
+            auto const amount = static_cast<std::size_t>(
+                std::min<std::uint64_t>(remaining_, buffer_.size()));
+            if (amount == 0) {
+                ec = {};
+                return boost::none;
+            }
+
+            auto const bytes = body_.file().read(buffer_.data(), amount, ec);
+            if (ec) return boost::none;
+            if (bytes == 0) {
+                // The file was truncated
+                ec = beast::http::error::short_read;
+                return boost::none;
+            }
+
+            remaining_ -= bytes;
+            return {{const_buffers_type{buffer_.data(), bytes},
+                     remaining_ > 0}};
+        }
+    };
+};
+
+/**
+ * Write a response whose body is a file range: the header with the
+ * serializer, then the range with sendfile(2), waiting for the socket to
+ * drain whenever it is full
+ * @param stream A beast::basic_stream over a TCP socket (the coroutine runs
+ * on its executor)
+ * @param timeout The longest the client may take to drain the socket
+ */
+template<class Stream, class Fields>
+net::awaitable<error_code, typename Stream::executor_type> sendFile(
+    Stream& stream,
+    beast::http::response<SendfileBody, Fields>& response,
+    std::chrono::steady_clock::duration timeout = std::chrono::seconds(30))
+{
+    // Resume this coroutine with the error, if any, rather than throwing it
+    error_code ec;
+    auto resume = net::redirect_error(
+        net::use_awaitable_t<typename Stream::executor_type>{}, ec);
+
+    beast::http::response_serializer<SendfileBody, Fields> serial(response);
+
+#if defined(__linux__)
+    co_await beast::http::async_write_header(stream, serial, resume);
+    if (ec) co_return ec;
+
+    auto& socket = stream.socket();
+    socket.native_non_blocking(true, ec);
+    if (ec) co_return ec;
+
+    // The bytes sent before other connections on the thread get a turn
+    std::uint64_t constexpr turn = 1024 * 1024;
+
+    auto& body = response.body();
+    auto offset = static_cast<off_t>(body.offset());
+    auto remaining = body.size();
+    std::uint64_t sent = 0;
+
+    while (remaining > 0) {
+        auto const bytes = ::sendfile(
+            socket.native_handle(),
+            body.file().native_handle(),
+            &offset,
+            static_cast<std::size_t>(std::min(remaining, turn)));
+
+        if (bytes > 0) {
+            remaining -= static_cast<std::uint64_t>(bytes);
+            sent += static_cast<std::uint64_t>(bytes);
+            if (sent >= turn) {
+                sent = 0;
+                co_await net::post(stream.get_executor(), resume);
+            }
+            continue;
+        }
+
+        // The file was truncated
+        if (bytes == 0) co_return beast::http::error::short_read;
+
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            co_return error_code{errno, boost::system::system_category()};
+        }
+
+        // The socket is full: wait until it drains, or time out. A wait
+        // is pending only while the flag is set (the timer handler may run
+        // after this function has returned)
+        net::basic_waitable_timer<std::chrono::steady_clock,
+            net::wait_traits<std::chrono::steady_clock>,
+            typename Stream::executor_type> timer(stream.get_executor(),
+                                                  timeout);
+        auto const isWaiting = std::make_shared<bool>(true);
+        timer.async_wait([&socket, isWaiting](error_code const& ec)
+            {
+                if (!ec && *isWaiting) socket.cancel();
+            });
+        co_await socket.async_wait(net::socket_base::wait_write, resume);
+        *isWaiting = false;
+        timer.cancel();
+
+        if (ec == net::error::operation_aborted) {
+            co_return beast::error::timeout;
+        }
+        if (ec) co_return ec;
+    }
+#else
+    co_await beast::http::async_write(stream, serial, resume);
+#endif
+    co_return ec;
+}
+
+ADAPTIV_SERVER_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
+
+#endif //ADAPTIV_SENDFILE_BODY_HPP
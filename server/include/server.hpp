@@ -21,12 +21,11 @@ ADAPTIV_NAMESPACE_BEGIN
 ADAPTIV_CLOUD_NAMESPACE_BEGIN
 ADAPTIV_SERVER_NAMESPACE_BEGIN
 
-/// Accepts incoming connections and launches the sessions
-void doListen(
+/// Accepts incoming connections and launches the sessions (a coroutine)
+net::awaitable<void> doListen(
     net::io_context& context,
     net::tcp::endpoint endpoint,
-    std::shared_ptr<SharedState> const& state,
-    net::yield_context yield);
+    std::shared_ptr<SharedState> state);
 
 ADAPTIV_SERVER_NAMESPACE_END
 ADAPTIV_CLOUD_NAMESPACE_END
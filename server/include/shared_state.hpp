@@ -8,16 +8,30 @@
 #ifndef ADAPTIV_SHARED_STATE_HPP
 #define ADAPTIV_SHARED_STATE_HPP
 
-#include <unordered_set>
+#include <array>
+#include <vector>
 #include <memory>
+#include <atomic>
+#include <utility>
+#include <functional>
 
 // WIP
 #include <thread>
 #include <mutex>
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
 #include <adaptiv/net/net.hpp>
 
 #include "solver.hpp"
+#include "options.hpp"
+#include "broadcast_ring.hpp"
+#include "broadcast_message.hpp"
+#include "message_pool.hpp"
+#include "recycler.hpp"
+#include "file_cache.hpp"
 
 ADAPTIV_NAMESPACE_BEGIN
 ADAPTIV_CLOUD_NAMESPACE_BEGIN
@@ -30,69 +44,257 @@ class WebSocketSession;
  * system needs to have access to
  */
 class SharedState
+    : public std::enable_shared_from_this<SharedState>
 {
-    net::io_context& context_;
-
     friend class solver::RANS;  ///< Solver needs access to enquee() and isBusy()
     solver::RANS ransSolver_;   ///< The solver (todo: ptr)
     std::thread solverThread_;  ///< A thread to run the solver
 
+#if defined(__linux__)
+    /**
+     * The cores the process may run on, taken when the state is made (i.e.
+     * before the shards pin their threads): the solver thread runs on any of
+     * them, rather than on the core of the shard that launched it
+     */
+    cpu_set_t cores_;
+#endif
+
     /// Also an http server that serves html files, etc
     std::string documentRoot_;
 
+    /// The runtime configuration of the server
+    Options options_;
+
+    /// The files of the document root, kept in memory
+    FileCache files_;
+
+    /// Recycles the broadcast messages (it outlives the log and the sessions)
+    MessagePool messages_;
+
+    /// Messages for every session: written by the solver, read by sessions
+    BroadcastRing<MessagePool::Ref> broadcast_;
+
+    /// The read buffers of closed sessions, with the memory they grew
+    Recycler<beast::flat_buffer> readBuffers_;
+
     // [shared resources] ------------------------------------------------ begin
     /// Synchronizes access between the server and solver threads
     std::mutex mutex_;
 
     ///< The server is busy and the solver might be accessing shared resources
     bool isBusy_ = false;
-
-    /// Keep a list of active websocket sessions (works with implicit strand)
-    std::unordered_set<WebSocketSession*> sessions_;
     // [shared resources]  ------------------------------------------------- end
 
+    /// An immutable list of the active websocket sessions
+    using registry_t = std::vector<std::weak_ptr<WebSocketSession>>;
+
+    /**
+     * An io_context (i.e. an event loop) and the sessions that run on it.
+     * The broadcast is the only traffic between shards: each shard wakes
+     * its own sessions up, from its own event loop
+     */
+    struct Shard
+    {
+        explicit Shard(net::io_context& context);
+
+        ~Shard();
+
+        Shard(Shard const&) = delete;
+        Shard& operator=(Shard const&) = delete;
+
+        net::io_context& context;
+
+        /**
+         * Keep a list of active websocket sessions (read-copy-update):
+         * readers load the current snapshot and iterate it without locking
+         * (see forEach()); join() and leave() copy it, modify the copy and
+         * swap it in (see replace()). A replaced snapshot is reclaimed once
+         * no reader can hold it (see reclaim())
+         */
+        std::atomic<registry_t const*> sessions;
+
+        /**
+         * Readers count themselves under the parity of the epoch they enter
+         * in. The epoch moves on once the readers of the other parity have
+         * left, so a snapshot replaced in epoch e has no reader left by
+         * epoch e + 2, however much the readers overlap
+         */
+        std::atomic<std::size_t> epoch{0};
+
+        /// The readers iterating a snapshot, by parity (see forEach())
+        std::array<std::atomic<std::size_t>, 2> readers{};
+
+        /// Serializes join() and leave() (readers never take it)
+        std::mutex registryMutex;
+
+        /// A replaced snapshot and the epoch it was replaced in
+        struct Retired
+        {
+            std::size_t epoch;
+            std::unique_ptr<registry_t const> sessions;
+        };
+
+        /// Replaced snapshots that may still have readers (registryMutex)
+        std::vector<Retired> retired;
+
+        /// \c retired holds snapshots: readers check it without the lock
+        std::atomic<bool> hasRetired{false};
+
+        /// A wake-up of the sessions is posted and has not run yet
+        std::atomic<bool> isNotifying{false};
+
+        /// Call \c function for each entry of the list \note Lock-free
+        template<class Function>
+        void forEach(Function&& function)
+        {
+            // Announced before loading the snapshot: see reclaim()
+            auto const parity = epoch.load() & 1;
+            readers[parity].fetch_add(1);
+            struct Leave
+            {
+                Shard& shard;
+                std::size_t parity;
+                ~Leave() { shard.endRead(parity); }
+            } const leave{*this, parity};
+
+            for (auto const& entry : *sessions.load()) {
+                function(entry);
+            }
+        }
+
+        /**
+         * Swap a new list in and reclaim the replaced ones that no reader
+         * can hold anymore
+         * @attention The caller holds registryMutex
+         */
+        void replace(std::unique_ptr<registry_t const> updated);
+
+        /**
+         * Move the epoch on as far as the readers allow, and delete the
+         * snapshots replaced two epochs ago or earlier
+         * @attention The caller holds registryMutex
+         */
+        void reclaim() noexcept;
+
+        /**
+         * A reader of a parity is done with its snapshot: the last one out
+         * reclaims, unless a writer holds the lock (it never waits then, the
+         * writer or a later reader reclaims)
+         */
+        void endRead(std::size_t parity) noexcept;
+    };
+
+    /// One per io_context (a single one unless the server is sharded)
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    /// The shard of an io_context
+    Shard& shard(net::io_context& context);
+
     // todo: replace friend class solver::RANS with friend functions
 
-    /// Pushes a message to the queue of each active session \note Thread-safe
-    void enqueue(std::string message);
+    /**
+     * Publishes a message to the broadcast log and wakes the sessions up.
+     * The cost does not depend on the number of sessions \note Thread-safe
+     * @param encoder Serializes the payload of the message, on demand (see
+     * BroadcastMessage::assign())
+     */
+    template<class Encoder>
+    void enqueue(Encoder&& encoder)
+    {
+        publish(messages_.make(std::forward<Encoder>(encoder)));
+    }
+
+    /// Publishes a message from the pool \see enqueue()
+    void publish(MessagePool::value_type message);
 
-    void isBusy(bool set);     ///< Setter \note Thread-safe
+    /// Setter, wakes the sessions up when clearing \note Thread-safe
+    void isBusy(bool set);
+
+    /**
+     * Wake up every session (the fan-out runs on the I/O threads of each
+     * shard). A single wake-up per shard is pending at a time: messages
+     * published meanwhile ride on it
+     */
+    void notify();
 
 public:
+    /// The io_contexts of the shards
+    using contexts_t = std::vector<std::reference_wrapper<net::io_context>>;
+
     explicit SharedState(
         net::io_context& context,
-        std::string documentRoot);
+        std::string documentRoot,
+        Options options = {});
+
+    /// A sharded server: the sessions of each io_context form a shard
+    explicit SharedState(
+        contexts_t const& contexts,
+        std::string documentRoot,
+        Options options = {});
 
     ~SharedState();
 
-    /// Add a new session \note Thread-safe
-    void join  (WebSocketSession* session);
+    /// Add a new session (to the shard it runs on) \note Thread-safe
+    void join  (std::shared_ptr<WebSocketSession> const& session);
 
-    /// Remove a session \note Thread-safe
+    /**
+     * Remove a session (called by its destructor, i.e. when it has expired)
+     * \note Thread-safe
+     */
     void leave (WebSocketSession* session);
 
     /**
-     * todo: reimplement this function based on WebSocketSession::flush()
-     * Pushes a message to the queue of each active session and then flushes
-     * the queue by writing all outgoing messages to the underlying websocket.
-     * @attention This function is \b NOT thread-safe and should only be used if
-     * the solver is not running (i.e. no risk in accessing each session queue)
+     * Publishes a message to the broadcast log and wakes the sessions up
+     * @param encoder Serializes the payload of the message, on demand
+     * @attention This function should only be used if the solver is not
+     * running: the log has a single producer
      */
-    void push(std::string message);
+    template<class Encoder>
+    void push(Encoder&& encoder)
+    {
+        // The writer of each session sends it
+        enqueue(std::forward<Encoder>(encoder));
+    }
 
-    void solve(); ///< Start the solver
+    /**
+     * Start the solver, unless another session has already done so
+     * @return True if this call launched the solver \note Thread-safe
+     */
+    bool solve();
 
     bool isBusy(); ///< Getter \note Thread-safe
 
-    std::mutex& mutex() { return mutex_; }
+    /// The log of broadcast messages \note Lock-free
+    BroadcastRing<MessagePool::Ref> const& broadcast() const noexcept
+    {
+        return broadcast_;
+    }
+
+    /// The read buffers of the sessions \note Thread-safe
+    Recycler<beast::flat_buffer>& readBuffers() noexcept
+    {
+        return readBuffers_;
+    }
 
     std::string const& documentRoot() const noexcept { return documentRoot_; }
 
+    /// The files of the document root \note Thread-safe
+    FileCache& files() noexcept { return files_; }
+
+    Options const& options() const noexcept { return options_; }
+
     // We'll use shared_ptr to manage the shared state (do we really?)
     /// Convenience function - make a shared_ptr
     static std::shared_ptr<SharedState> makeShared(
         net::io_context& context,
-        std::string documentRoot);
+        std::string documentRoot,
+        Options options = {});
+
+    /// Convenience function - make a shared_ptr for a sharded server
+    static std::shared_ptr<SharedState> makeShared(
+        contexts_t const& contexts,
+        std::string documentRoot,
+        Options options = {});
 };
 
 ADAPTIV_SERVER_NAMESPACE_END
@@ -14,11 +14,16 @@
 #include <cstddef>
 #include <thread>
 #include <chrono>
+#include <memory>
+#include <string>
 
 #include <adaptiv/macros.hpp>
 #include <adaptiv/math/random.hpp>
 #include <adaptiv/cloud/protocol/response.hpp>
 
+#include "broadcast_message.hpp"
+#include "rans_template.hpp"
+
 ADAPTIV_NAMESPACE_BEGIN
 ADAPTIV_CLOUD_NAMESPACE_BEGIN
 ADAPTIV_SERVER_NAMESPACE_BEGIN
@@ -70,7 +75,24 @@ private:
     } residuals_;
 
     void update();
-    std::string response();
+
+    /// A response, serialized on demand (i.e. by the sessions)
+    struct Response
+    {
+        std::shared_ptr<RANSTemplate const> layout;
+        protocol::RANSResponse result;
+
+        void operator()(protocol::Format format, std::string& out) const
+        {
+            layout->encode(result, format, out);
+        }
+    };
+
+    /**
+     * The current response
+     * @param layout Shared by the responses of the run
+     */
+    Response response(std::shared_ptr<RANSTemplate const> layout) const;
 
 public:
     explicit RANS(
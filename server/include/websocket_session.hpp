@@ -9,9 +9,25 @@
 #define WEBSOCKET_SESSION_HPP
 
 #include <memory>
-#include <queue>
+#include <string>
+#include <deque>
+#include <string_view>
+#include <optional>
+#include <cstddef>
+#include <vector>
+#include <atomic>
+#include <chrono>
 
 #include <adaptiv/cloud/cloud.hpp>
+#include <adaptiv/cloud/protocol/inbound.hpp>
+#include <adaptiv/cloud/protocol/request.hpp>
+#include <adaptiv/cloud/protocol/messages/server_status.hpp>
+#include <adaptiv/cloud/protocol/messages/rans.hpp>
+
+#include "options.hpp"
+#include "broadcast_ring.hpp"
+#include "broadcast_message.hpp"
+#include "message_pool.hpp"
 
 ADAPTIV_NAMESPACE_BEGIN
 ADAPTIV_CLOUD_NAMESPACE_BEGIN
@@ -19,90 +35,269 @@ ADAPTIV_SERVER_NAMESPACE_BEGIN
 
 class SharedState;
 
+/**
+ * The executor of a connection: its strand. Every asynchronous operation
+ * copies it, so it is named rather than type-erased (net::any_io_executor
+ * allocates whenever it copies a strand)
+ */
+using executor_t = net::strand<net::io_context::executor_type>;
+
+/// The TCP stream of a connection
+using stream_t = beast::basic_stream<net::tcp, executor_t>;
+
+/**
+ * The coroutines of a connection (stackless, run on its strand): a session
+ * costs a coroutine frame per active function rather than a whole stack
+ */
+template<class T = void>
+using awaitable_t = net::awaitable<T, executor_t>;
+
+/// Completion token: resume the coroutine of the connection
+inline constexpr net::use_awaitable_t<executor_t> use_awaitable{};
+
+/**
+ * Completion token: resume the coroutine of the connection with the error,
+ * if any, in \c ec (i.e. rather than thrown)
+ */
+inline auto redirect(error_code& ec)
+{
+    return net::redirect_error(use_awaitable, ec);
+}
+
 /// Represents an active WebSocket connection
 class WebSocketSession
+    : public std::enable_shared_from_this<WebSocketSession>
 {
+public:
+    /// Outgoing broadcast traffic
+    struct Counters
+    {
+        std::size_t messages = 0; ///< Broadcast messages sent
+        std::size_t frames   = 0; ///< Frames (i.e. writes) used to send them
+
+        /// Messages skipped because the session fell behind
+        std::size_t dropped = 0;
+
+        /// The largest backlog (unsent messages) the session has had
+        std::size_t highWater = 0;
+
+        /// Frames, and therefore write syscalls, saved by coalescing
+        std::size_t saved() const noexcept { return messages - frames; }
+    };
+
+private:
     friend class SharedState; ///< SharedState needs access
 
-    /// A queue of immutable shared strings
-    using queue_t = std::queue<std::shared_ptr<std::string const>>;
+    /// The broadcast log of immutable shared messages
+    using ring_t = BroadcastRing<MessagePool::Ref>;
 
     /// The underlying I/O object for current session
-    beast::websocket::stream<beast::tcp_stream> websocket_;
+    beast::websocket::stream<stream_t> websocket_;
 
     /// The server state, accessible from all active sessions
     std::shared_ptr<SharedState> state_;
 
     bool hasConnection_ = true; ///< Check that the connection is active
 
-    /// To avoid initiating multiple invocations of flush
-    bool isFlushing_ = false;
+    /// The wire format negotiated during the handshake
+    protocol::Format format_ = protocol::Format::json;
 
-    // [shared resources] ------------------------------------------------ begin
-    /// A per-session queue of outgoing messages
-    queue_t queue_;
+    /// A timer used as a signal: a coroutine waits on it until cancelled
+    using signal_t = net::basic_waitable_timer<std::chrono::steady_clock,
+        net::wait_traits<std::chrono::steady_clock>, executor_t>;
 
-    // Thread-safe functions for the shared resource
-    bool                 queueEmpty(); ///< Check empty \note Thread-safe
-    queue_t::value_type& queueFront(); ///< First element \note Thread-safe
-    void                 queuePop();   ///< Pop first element \note Thread-safe
-    void                 queueClear(); ///< Clear the queue \note Thread-safe
-    queue_t              queueCopy();  ///< Return a copy \note Thread-safe
+    /// The writer waits on it and notify() cancels the wait
+    signal_t signal_;
 
-    // [shared resources]  ------------------------------------------------- end
+    /// A wake-up is posted and has not run yet (see notify())
+    std::atomic<bool> isNotified_{false};
+
+    // [control] --------------------------------------------------------- begin
+    /**
+     * Replies to the client (e.g. status, errors) take priority over the
+     * broadcast messages, so they do not wait behind a streaming solve
+     */
+    std::deque<std::string> control_;
+
+    /// Control frames sent in a row before a pending broadcast frame is sent
+    static std::size_t constexpr controlBurst = 8;
+
+    /**
+     * Unsent replies at which the reader stops taking requests, until the
+     * writer sends some: a client that does not read its replies can not
+     * grow the queue without bounds
+     */
+    static std::size_t constexpr controlBacklog = 64;
+
+    /// The reader waits on it while the replies are over the backlog
+    signal_t drained_;
+
+    /// Queue a reply and wake the writer up
+    void reply(std::string message);
+
+    /**
+     * The current status of the server, as a response in the session format
+     * @param error The error to report, if any
+     * @param id The id of the request answered, if any
+     */
+    std::string status(
+        std::string error = "",
+        protocol::id_t id = protocol::unsolicited) const;
+
+    /**
+     * Handle a request from the client: a NetworkExchange is dispatched to
+     * the handler of its target, otherwise it is a plain text command (i.e.
+     * "solve" or "status", e.g. from the browser page)
+     * @param buffer The received frame, parsed in place (i.e. modified)
+     * @note A frame may hold a batch of requests: a JSON array, or binary
+     * requests back to back. The batch is answered with a single frame (in
+     * the same layout) holding a reply, possibly an error, for each request
+     * @note Handlers never wait (a solve streams through the broadcast log)
+     * so the reader takes the next request at once: a client may have many
+     * outstanding requests on its connection (up to the control backlog),
+     * and matches the replies to them by id
+     */
+    void handle(beast::flat_buffer& buffer);
+
+    /**
+     * Handle a plain text command
+     * @return False if \c request is not a command
+     */
+    bool command(std::string_view request);
+
+    /**
+     * Dispatch the next request of a frame to the handler of its target (see
+     * protocol::Router: the request type is that of the handler parameter)
+     * @return The reply to the request
+     */
+    std::string dispatch(protocol::Inbound& inbound);
+
+    /// Target "status": reply with the server status
+    std::string onStatus(
+        protocol::Request<protocol::requests::ServerStatus> const& request);
+
+    /**
+     * Target "solve": start the solver (or join the ongoing solve) and
+     * acknowledge with the server status; the RANS responses follow on the
+     * broadcast stream
+     */
+    std::string onSolve(
+        protocol::Request<protocol::RANSRequest> const& request);
+    // [control] ----------------------------------------------------------- end
+
+    // [broadcast] ------------------------------------------------------- begin
+    /// Sequence number of the next broadcast message to send to the client
+    ring_t::sequence_t cursor_;
+
+    /// The backlog limit of the session (at most the log capacity)
+    std::size_t const backlogLimit_;
+
+    /// The session fell behind and the policy is to disconnect it
+    bool isTooSlow_ = false;
+
+    /// The messages of the frame being coalesced (its memory is reused)
+    std::vector<ring_t::value_type> batch_;
+
+    /// The buffers of the coalesced frame (its memory is reused)
+    std::vector<net::const_buffer> buffers_;
+
+    /// Check for unsent broadcast messages \note Lock-free
+    bool hasPending() const;
+
+    /**
+     * Apply the slow consumer policy if the backlog exceeds the limit and
+     * update the high-water mark
+     * @return False if the session must be disconnected
+     */
+    bool catchUp();
+
+    /**
+     * Take the next unsent broadcast message, skipping the ones that have
+     * been overwritten or dropped by the slow consumer policy. Returns
+     * \c nullptr if there is none
+     * \note Lock-free
+     */
+    ring_t::value_type next();
+    // [broadcast] --------------------------------------------------------- end
+
+    /**
+     * Send the next broadcast frame: a single message or, if coalescing is
+     * enabled, the messages that arrive within the latency and size budgets
+     * as a single frame (a gathered write of the shared messages): a JSON
+     * array, or the binary messages back to back
+     */
+    awaitable_t<error_code> sendNext();
+
+    Counters counters_; ///< Outgoing broadcast traffic
+
+    /// Close a session that fell behind (the disconnect policy)
+    awaitable_t<> disconnect();
 
     /// Send a single message
-    void message(std::string const& msg, boost::asio::yield_context yield);
+    awaitable_t<> message(std::string const& msg);
+
+    /// Read and handle requests until the connection is closed
+    awaitable_t<> read();
 
 public:
     explicit WebSocketSession(
-        net::tcp::socket&& socket,
+        stream_t::socket_type&& socket,
         std::shared_ptr<SharedState> state);
 
     ~WebSocketSession();
 
-    /// Accept the websocket handshake
+    /**
+     * Accept the websocket handshake and negotiate the wire format: the
+     * first subprotocol offered by the client that names a known format,
+     * otherwise JSON (e.g. browsers that offer none)
+     */
     template<class Body, class Allocator>
-    error_code accept(
+    awaitable_t<error_code> accept(
         beast::http::request<Body
-                            ,beast::http::basic_fields<Allocator>> request,
-        net::yield_context yield);
+                            ,beast::http::basic_fields<Allocator>> request);
 
     /// Send a welcome message
-    void welcome(net::yield_context yield);
+    awaitable_t<> welcome();
 
     /**
-     * todo: probably delete this function and use flush (only)
-     * Write the queue to the websocket
-     * @attention This function is \b NOT thread-safe and should only be used if
-     * the solver is not running (i.e. no risk in accessing the session queue)
+     * Run the WebSocketSession until the connection is closed. Requests are
+     * read by a separate coroutine (on the same strand), so that the client
+     * can be answered while a solve streams; this coroutine is the only
+     * writer: it sends the control replies first and then the broadcast
+     * messages, without starving the latter.
      */
-    void write(net::yield_context yield); // non thread safe
+    awaitable_t<> run();
 
     /**
-     * Flush the shared queue by copying its contents into a temporary queue
-     * that is then written to the websocket. This function immediately clears
-     * the shared queue making it available for other threads.
-     *
+     * Wake up the session if it is waiting for outgoing messages (i.e. there
+     * are new broadcast messages or the solver has finished)
+     * @note Thread-safe: the wake-up is posted to the strand of the session
      */
-    void flush(net::yield_context yield); // Thread-safe
-
-    /// Run the WebSocketSession
-    void run(net::yield_context yield);
+    void notify();
 
     /// Convenience function - make a shared_ptr
     static std::shared_ptr<WebSocketSession> makeShared(
-        net::tcp::socket&& socket,
+        stream_t::socket_type&& socket,
         std::shared_ptr<SharedState> const& state);
 
     bool hasConnection() const noexcept { return hasConnection_; }
+
+    /// The io_context the session runs on (i.e. its shard)
+    net::io_context& context() noexcept
+    {
+        return websocket_.get_executor().get_inner_executor().context();
+    }
+
+    Counters const& counters() const noexcept { return counters_; }
+
+    /// The runtime configuration of the server
+    Options const& options() const noexcept;
 };
 
 template<class Body, class Allocator>
-error_code WebSocketSession::accept(
+awaitable_t<error_code> WebSocketSession::accept(
     beast::http::request<Body
-                        ,beast::http::basic_fields<Allocator>> request,
-    net::yield_context yield)
+                        ,beast::http::basic_fields<Allocator>> request)
 {
     error_code ec;
 
@@ -111,17 +306,36 @@ error_code WebSocketSession::accept(
         beast::websocket::stream_base::timeout::suggested(
             beast::role_type::server));
 
+    // Negotiate compression, if the client offers it
+    websocket_.set_option(net::permessageDeflate(
+        options().deflate, beast::role_type::server));
+
+    // Negotiate the wire format
+    auto const offer = request[beast::http::field::sec_websocket_protocol];
+    auto const format = protocol::negotiate({offer.data(), offer.size()});
+    format_ = format.value_or(protocol::Format::json);
+
     // Set a decorator to change the server of the handshake
     websocket_.set_option(beast::websocket::stream_base::decorator(
-        [](beast::websocket::response_type& response)
+        [format](beast::websocket::response_type& response)
         {
             response.set(beast::http::field::server,
                          std::string(ADAPTIV_VERSION_STRING) + "_server");
+
+            // Confirm the subprotocol the format was negotiated from
+            if (format) {
+                auto const name = protocol::subprotocol(*format);
+                response.set(beast::http::field::sec_websocket_protocol,
+                             beast::string_view(name.data(), name.size()));
+            }
         }));
 
     // Accept the Websocket handshake
-    websocket_.async_accept(request, yield[ec]);
-    return ec;
+    co_await websocket_.async_accept(request, redirect(ec));
+
+    // Outgoing frames: binary or text
+    websocket_.binary(format_ == protocol::Format::binary);
+    co_return ec;
 }
 
 ADAPTIV_SERVER_NAMESPACE_END
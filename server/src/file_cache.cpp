@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#include <optional>
+#include <utility>
+
+#include <boost/crc.hpp>
+#include <boost/beast/zlib/deflate_stream.hpp>
+
+#include "file_cache.hpp"
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_SERVER_NAMESPACE_BEGIN
+
+namespace {
+
+/// Larger files are streamed from disk
+std::uintmax_t constexpr largestCached = 8 * 1024 * 1024;
+
+/// The variants are compressed once, so they might as well be small
+int constexpr compressionLevel = 9;
+
+/// The known extensions, and their mime type
+std::pair<beast::string_view, beast::string_view> const mimeTypes[] = {
+    {".htm",  "text/html"},
+    {".html", "text/html"},
+    {".php",  "text/html"},
+    {".css",  "text/css"},
+    {".txt",  "text/plain"},
+    {".js",   "application/javascript"},
+    {".json", "application/json"},
+    {".xml",  "application/xml"},
+    {".swf",  "application/x-shockwave-flash"},
+    {".flv",  "video/x-flv"},
+    {".png",  "image/png"},
+    {".jpe",  "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".jpg",  "image/jpeg"},
+    {".gif",  "image/gif"},
+    {".bmp",  "image/bmp"},
+    {".ico",  "image/vnd.microsoft.icon"},
+    {".tiff", "image/tiff"},
+    {".tif",  "image/tiff"},
+    {".svg",  "image/svg+xml"},
+    {".svgz", "image/svg+xml"}
+};
+
+/// Worth compressing (the media types that are not compressed already)
+bool isCompressible(beast::string_view mime)
+{
+    return mime.starts_with("text/") ||
+           mime == "application/javascript" ||
+           mime == "application/json" ||
+           mime == "application/xml" ||
+           mime == "image/svg+xml";
+}
+
+/// Compress \c data in the raw deflate format (RFC 1951)
+std::string deflateRaw(std::string const& data)
+{
+    namespace zlib = beast::zlib;
+
+    zlib::deflate_stream stream;
+    stream.reset(compressionLevel, 15, 8, zlib::Strategy::normal);
+
+    // A single step: the output has room for the worst case
+    std::string out(stream.upper_bound(data.size()), '\0');
+    zlib::z_params zs;
+    zs.next_in = data.data();
+    zs.avail_in = data.size();
+    zs.next_out = &out[0];
+    zs.avail_out = out.size();
+
+    error_code ec;
+    stream.write(zs, zlib::Flush::finish, ec);
+    if (ec != zlib::error::end_of_stream) return {};
+
+    out.resize(zs.total_out);
+    return out;
+}
+
+/// Append \c value, least significant byte first
+void appendLittleEndian(std::string& out, std::uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+/// Append \c value, most significant byte first
+void appendBigEndian(std::string& out, std::uint32_t value)
+{
+    for (int i = 3; i >= 0; --i) {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+/// The gzip coding (RFC 1952): a header, raw deflate, CRC-32 and size
+std::string gzip(std::string const& data, std::string const& deflated)
+{
+    // Deflate, no flags, no time stamp, best compression, unknown OS
+    static char const header[] = {
+        '\x1F', '\x8B', '\x08', '\x00', '\x00', '\x00', '\x00', '\x00',
+        '\x02', '\xFF'};
+
+    boost::crc_32_type crc;
+    crc.process_bytes(data.data(), data.size());
+
+    std::string out;
+    out.reserve(sizeof(header) + deflated.size() + 8);
+    out.append(header, sizeof(header));
+    out.append(deflated);
+    appendLittleEndian(out, crc.checksum());
+    appendLittleEndian(out, static_cast<std::uint32_t>(data.size()));
+    return out;
+}
+
+/// The deflate coding (RFC 1950, the zlib format): header, deflate, Adler-32
+std::string zlibWrap(std::string const& data, std::string const& deflated)
+{
+    // 32K window, best compression (the header is a multiple of 31)
+    static char const header[] = {'\x78', '\xDA'};
+
+    std::uint32_t a = 1, b = 0;
+    for (unsigned char const c : data) {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+
+    std::string out;
+    out.reserve(sizeof(header) + deflated.size() + 4);
+    out.append(header, sizeof(header));
+    out.append(deflated);
+    appendBigEndian(out, (b << 16) | a);
+    return out;
+}
+
+/// Strip the optional whitespace around a list element or parameter
+beast::string_view trim(beast::string_view text)
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+/// A quality value of zero (i.e. "not acceptable")
+bool isRefused(beast::string_view quality)
+{
+    if (quality.empty() || quality.front() != '0') return false;
+    for (auto const c : quality.substr(1)) {
+        if (c != '.' && c != '0') return false;
+    }
+    return true;
+}
+
+/// Convert an error of the filesystem library
+error_code toErrorCode(std::error_code const& ec)
+{
+    return {ec.value(), boost::system::generic_category()};
+}
+
+} // namespace
+
+beast::string_view mimeType(beast::string_view path)
+{
+    auto const pos = path.rfind('.');
+    if (pos != beast::string_view::npos) {
+        auto const extension = path.substr(pos);
+        for (auto const& [known, mime] : mimeTypes) {
+            if (beast::iequals(extension, known)) return mime;
+        }
+    }
+    return "application/text";
+}
+
+FileCache::Variant const& FileCache::Entry::negotiate(
+    beast::string_view acceptEncoding) const
+{
+    // Explicit codings take precedence over "*", whatever the order
+    std::optional<bool> any;
+    std::array<std::optional<bool>, 3> accepted;
+
+    // A comma separated list of codings, each with an optional "q" weight
+    // (parsed here: beast::http::ext_list repeats parameters in Boost 1.74)
+    while (!acceptEncoding.empty()) {
+        auto const comma = acceptEncoding.find(',');
+        auto const element = acceptEncoding.substr(0, comma);
+        acceptEncoding.remove_prefix(
+            comma == beast::string_view::npos ? element.size() : comma + 1);
+
+        auto const semicolon = element.find(';');
+        auto const coding = trim(element.substr(0, semicolon));
+
+        bool isAccepted = true;
+        if (semicolon != beast::string_view::npos) {
+            auto const weight = element.substr(semicolon + 1);
+            auto const equal = weight.find('=');
+            if (equal != beast::string_view::npos &&
+                beast::iequals(trim(weight.substr(0, equal)), "q")) {
+                isAccepted = !isRefused(trim(weight.substr(equal + 1)));
+            }
+        }
+
+        if (coding == "*") {
+            any = isAccepted;
+        } else if (beast::iequals(coding, name(Coding::gzip)) ||
+                   beast::iequals(coding, "x-gzip")) {
+            accepted[static_cast<std::size_t>(Coding::gzip)] = isAccepted;
+        } else if (beast::iequals(coding, name(Coding::deflate))) {
+            accepted[static_cast<std::size_t>(Coding::deflate)] = isAccepted;
+        }
+    }
+
+    for (auto const coding : {Coding::gzip, Coding::deflate}) {
+        auto const index = static_cast<std::size_t>(coding);
+        if (!variants[index].body.empty() &&
+            accepted[index].value_or(any.value_or(false))) {
+            return variants[index];
+        }
+    }
+    return variants[static_cast<std::size_t>(Coding::identity)];
+}
+
+std::size_t FileCache::Entry::memory() const noexcept
+{
+    std::size_t bytes = sizeof(Entry);
+    for (auto const& variant : variants) {
+        bytes += variant.body.size() + variant.etag.size();
+    }
+    return bytes;
+}
+
+FileCache::FileCache(std::size_t budget)
+    : budget_(budget)
+{ }
+
+FileCache::entry_t FileCache::find(std::string const& path, error_code& ec)
+{
+    namespace fs = std::filesystem;
+
+    ec = {};
+    if (budget_ == 0) return nullptr;
+
+    // The version on disk (a stat, instead of reading the file)
+    std::error_code status;
+    auto const modified = fs::last_write_time(path, status);
+    auto const size = status ? 0 : fs::file_size(path, status);
+    if (status) {
+        // Gone (or a directory, which is not a resource): keep no memory
+        evict(path);
+        ec = status == std::errc::is_a_directory ?
+            boost::system::errc::make_error_code(
+                boost::system::errc::no_such_file_or_directory) :
+            toErrorCode(status);
+        return nullptr;
+    }
+
+    {
+        std::shared_lock guard(mutex_);
+        auto const found = entries_.find(path);
+        auto const isCached = found != entries_.end();
+        if (isCached && found->second->isVersion(modified, size)) {
+            return found->second;
+        }
+
+        // Does not fit: serve it from disk instead of reading it every time
+        auto const replaced = isCached ? found->second->memory() : 0;
+        if (size > largestCached || memory_ - replaced + size > budget_) {
+            guard.unlock();
+            if (isCached) evict(path);
+            return nullptr;
+        }
+    }
+
+    // A single request reads the file, the others wait for it
+    std::promise<entry_t> loaded;
+    std::shared_future<entry_t> pending;
+    {
+        std::lock_guard guard(mutex_);
+        auto const found = entries_.find(path);
+        if (found != entries_.end() &&
+            found->second->isVersion(modified, size)) {
+            return found->second;
+        }
+
+        auto const [loading, isReader] = loading_.try_emplace(path);
+        if (isReader) {
+            loading->second = loaded.get_future().share();
+        } else {
+            pending = loading->second;
+        }
+    }
+
+    if (pending.valid()) {
+        // The read failed, or got another version: serve this one from disk
+        auto entry = pending.get();
+        return entry && entry->isVersion(modified, size) ? entry : nullptr;
+    }
+
+    entry_t entry;
+    try {
+        entry = load(path, modified, size, ec);
+    } catch (...) {
+        store(path, nullptr);
+        loaded.set_value(nullptr);
+        throw;
+    }
+
+    store(path, entry);
+    loaded.set_value(entry);
+    return entry;
+}
+
+FileCache::entry_t FileCache::store(std::string const& path, entry_t entry)
+{
+    std::lock_guard guard(mutex_);
+    loading_.erase(path);
+
+    auto const found = entries_.find(path);
+    auto const replaced = found != entries_.end() ?
+        found->second->memory() : 0;
+
+    if (!entry || memory_ - replaced + entry->memory() > budget_) {
+        // Unreadable, or another file took the room meanwhile: send this
+        // one, do not keep it
+        if (found != entries_.end()) {
+            memory_ -= replaced;
+            entries_.erase(found);
+        }
+        return entry;
+    }
+
+    memory_ += entry->memory() - replaced;
+    entries_[path] = entry;
+    return entry;
+}
+
+void FileCache::evict(std::string const& path)
+{
+    {
+        // Most misses (e.g. a 404) have nothing to evict
+        std::shared_lock guard(mutex_);
+        if (entries_.find(path) == entries_.end()) return;
+    }
+
+    std::lock_guard guard(mutex_);
+    auto const found = entries_.find(path);
+    if (found == entries_.end()) return;
+
+    memory_ -= found->second->memory();
+    entries_.erase(found);
+}
+
+std::size_t FileCache::memory() const
+{
+    std::shared_lock guard(mutex_);
+    return memory_;
+}
+
+beast::string_view FileCache::name(Coding coding) noexcept
+{
+    switch (coding) {
+        case Coding::gzip:    return "gzip";
+        case Coding::deflate: return "deflate";
+        default:              return "identity";
+    }
+}
+
+std::string FileCache::entityTag(std::uintmax_t size,
+                                 std::filesystem::file_time_type modified,
+                                 beast::string_view coding)
+{
+    // "<size>-<modified>[-coding]", in hexadecimal
+    auto const hex = [](std::uint64_t value)
+    {
+        char digits[16];
+        char* end = digits + sizeof(digits);
+        char* begin = end;
+        do {
+            *--begin = "0123456789abcdef"[value & 0xF];
+            value >>= 4;
+        } while (value != 0);
+        return std::string(begin, end);
+    };
+
+    std::string tag = "\"" + hex(size) + '-' +
+        hex(static_cast<std::uint64_t>(modified.time_since_epoch().count()));
+    if (!coding.empty()) {
+        tag += '-';
+        tag.append(coding.data(), coding.size());
+    }
+    tag += '"';
+    return tag;
+}
+
+bool FileCache::matches(beast::string_view ifNoneMatch,
+                        beast::string_view etag)
+{
+    // A comma separated list of (possibly weak) entity tags, or "*"
+    while (!ifNoneMatch.empty()) {
+        auto const c = ifNoneMatch.front();
+        if (c == ' ' || c == '\t' || c == ',') {
+            ifNoneMatch.remove_prefix(1);
+            continue;
+        }
+        if (c == '*') return true;
+
+        // The weak comparison ignores the weak indicator
+        if (ifNoneMatch.starts_with("W/")) ifNoneMatch.remove_prefix(2);
+
+        auto end = beast::string_view::npos;
+        if (ifNoneMatch.starts_with('"')) {
+            end = ifNoneMatch.find('"', 1);
+            if (end != beast::string_view::npos) ++end;
+        } else {
+            end = ifNoneMatch.find(',');
+        }
+
+        auto const tag = ifNoneMatch.substr(0, end);
+        if (tag == etag) return true;
+        ifNoneMatch.remove_prefix(tag.size());
+    }
+    return false;
+}
+
+FileCache::entry_t FileCache::load(
+    std::string const& path,
+    std::filesystem::file_time_type modified,
+    std::uintmax_t size,
+    error_code& ec) const
+{
+    beast::file file;
+    file.open(path.c_str(), beast::file_mode::scan, ec);
+    if (ec) return nullptr;
+
+    auto entry = std::make_shared<Entry>();
+    entry->mime = mimeType(path);
+    entry->modified = modified;
+    entry->size = size;
+
+    // The file may be truncated meanwhile: the next lookup reads it again
+    auto& identity = entry->variants[static_cast<std::size_t>(
+        Coding::identity)];
+    identity.body.resize(static_cast<std::size_t>(size));
+    std::size_t read = 0;
+    while (read < identity.body.size()) {
+        auto const bytes = file.read(
+            &identity.body[read], identity.body.size() - read, ec);
+        if (ec) return nullptr;
+        if (bytes == 0) break;
+        read += bytes;
+    }
+    identity.body.resize(read);
+    identity.etag = entityTag(size, modified);
+
+    if (isCompressible(entry->mime) && !identity.body.empty()) {
+        auto const deflated = deflateRaw(identity.body);
+        if (!deflated.empty()) {
+            auto const keep = [&](Coding coding, std::string body)
+            {
+                // Only if it pays off
+                if (body.size() >= identity.body.size()) return;
+                auto& variant = entry->variants[
+                    static_cast<std::size_t>(coding)];
+                variant.body = std::move(body);
+                variant.etag = entityTag(size, modified, name(coding));
+                entry->isCompressed = true;
+            };
+            keep(Coding::gzip, gzip(identity.body, deflated));
+            keep(Coding::deflate, zlibWrap(identity.body, deflated));
+        }
+    }
+
+    return entry;
+}
+
+ADAPTIV_SERVER_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
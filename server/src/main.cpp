@@ -1,47 +1,140 @@
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <cstdlib>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include <adaptiv/net/net.hpp>
 
 #include "server.hpp"
 #include "solver.hpp"
+#include "options.hpp"
+#include "shared_state.hpp"
 
 namespace server = adaptiv::cloud::server;
 namespace net = adaptiv::net;
 
+namespace {
+
+/**
+ * Pin the calling thread to a core, so that a shard keeps its caches: the
+ * n-th of the cores the process may run on (wrapping around)
+ */
+void pinToCore(std::size_t n)
+{
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+
+    auto const cores = static_cast<std::size_t>(CPU_COUNT(&allowed));
+    if (cores == 0) return;
+    n %= cores;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        if (n-- == 0) {
+            cpu_set_t core;
+            CPU_ZERO(&core);
+            CPU_SET(cpu, &core);
+            // Best effort: the shard still runs if it can not be pinned
+            pthread_setaffinity_np(pthread_self(), sizeof(core), &core);
+            return;
+        }
+    }
+#else
+    (void)n;
+#endif
+}
+
+} // namespace
+
 int main(int argc, char** argv)
 {
     // Check command line arguments
-    if (argc != 4) {
+    if (argc < 4) {
         std::cerr <<
-                  "  Usage: server <address> <port> <documentRoot>\n" <<
+                  "  Usage: server <address> <port> <documentRoot> "
+                  "[options]\n" <<
+                  server::optionsUsage() <<
                   "Example:\n" <<
-                  "         server 127.0.0.1 8080 .\n";
+                  "         server 127.0.0.1 8080 . --threads=4\n";
         return EXIT_FAILURE;
     }
     auto const address = adaptiv::net::ip::make_address(argv[1]);
     auto const port = static_cast<unsigned short>(std::atoi(argv[2]));
     auto const documentRoot = argv[3];
 
-    // The io_context is required for all I/O
-    net::io_context context;
+    server::Options options;
+    try {
+        options = server::parseOptions(argc, argv, 4);
+    } catch (std::invalid_argument const& exception) {
+        std::cerr << "error: " << exception.what() << '\n' <<
+                  server::optionsUsage();
+        return EXIT_FAILURE;
+    }
+
+    // The io_contexts are required for all I/O: a single one run by every
+    // thread or, if sharded, one per shard run by a thread of its own
+    auto const shards = std::max<std::size_t>(options.shards, 1);
+    int const hint = options.shards > 0 ? 1 : static_cast<int>(options.threads);
+    std::vector<std::unique_ptr<net::io_context>> contexts;
+    server::SharedState::contexts_t shared;
+    for (std::size_t i = 0; i < shards; ++i) {
+        contexts.push_back(std::make_unique<net::io_context>(hint));
+        shared.emplace_back(*contexts.back());
+    }
 
-    // Spawn a listening port
-    net::spawn(
-        context,
-        [&context, address, port, documentRoot]
-        (net::yield_context yield)
-        {
+    // The shards only share the solver and its broadcast. Made before the
+    // shards pin their threads: the solver runs on any core
+    auto const state =
+        server::SharedState::makeShared(shared, documentRoot, options);
+
+    // Spawn a listening port on each shard
+    for (auto& context : contexts) {
+        net::co_spawn(
+            *context,
             server::doListen(
-                context,
+                *context,
                 net::tcp::endpoint{address, port},
-                server::SharedState::makeShared(context, documentRoot),
-                yield);
+                state),
+            net::detached
+        );
+    }
+
+    // Run the I/O service on the requested number of threads
+    std::vector<std::thread> pool;
+    if (options.shards > 0) {
+        pool.reserve(shards - 1);
+        for (std::size_t i = 1; i < shards; ++i) {
+            pool.emplace_back([&context = *contexts[i], i]
+                {
+                    pinToCore(i);
+                    context.run();
+                });
+        }
+        pinToCore(0);
+    } else {
+        pool.reserve(options.threads - 1);
+        for (std::size_t i = 1; i < options.threads; ++i) {
+            pool.emplace_back([&context = *contexts.front()]
+                {
+                    context.run();
+                });
         }
-    );
+    }
+    contexts.front()->run();
 
-    context.run();
+    for (auto& thread : pool) {
+        thread.join();
+    }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#include <stdexcept>
+#include <string>
+#include <functional>
+#include <map>
+
+#include "options.hpp"
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_SERVER_NAMESPACE_BEGIN
+
+namespace detail {
+
+using net::toUnsigned;
+using net::toBounded;
+
+/// Assigns the value of an option
+using setter_t = std::function<void(Options&, std::string const&)>;
+
+/// Each known option and how to set it
+std::map<std::string, setter_t> const& setters()
+{
+    static std::map<std::string, setter_t> const known {
+        {"threads", [](Options& options, std::string const& value)
+            {
+                options.threads = toUnsigned("threads", value);
+                if (options.threads == 0) {
+                    throw std::invalid_argument(
+                        "option '--threads' must be at least 1");
+                }
+            }},
+        {"shards", [](Options& options, std::string const& value)
+            {
+                options.shards = toUnsigned("shards", value);
+            }},
+        {"broadcast-capacity", [](Options& options, std::string const& value)
+            {
+                options.broadcastCapacity =
+                    toUnsigned("broadcast-capacity", value);
+                if (options.broadcastCapacity == 0) {
+                    throw std::invalid_argument(
+                        "option '--broadcast-capacity' must be at least 1");
+                }
+            }},
+        {"coalesce-window", [](Options& options, std::string const& value)
+            {
+                options.coalesceWindow = std::chrono::microseconds(
+                    toUnsigned("coalesce-window", value));
+            }},
+        {"coalesce-bytes", [](Options& options, std::string const& value)
+            {
+                options.coalesceBytes = toUnsigned("coalesce-bytes", value);
+                if (options.coalesceBytes == 0) {
+                    throw std::invalid_argument(
+                        "option '--coalesce-bytes' must be at least 1");
+                }
+            }},
+        {"session-backlog", [](Options& options, std::string const& value)
+            {
+                options.sessionBacklog = toUnsigned("session-backlog", value);
+            }},
+        {"slow-consumer", [](Options& options, std::string const& value)
+            {
+                if (value == "drop-oldest") {
+                    options.slowConsumer = SlowConsumerPolicy::dropOldest;
+                } else if (value == "latest") {
+                    options.slowConsumer = SlowConsumerPolicy::latest;
+                } else if (value == "disconnect") {
+                    options.slowConsumer = SlowConsumerPolicy::disconnect;
+                } else {
+                    throw std::invalid_argument("option '--slow-consumer' "
+                        "must be drop-oldest, latest or disconnect");
+                }
+            }},
+        {"json", [](Options& options, std::string const& value)
+            {
+                if (value != "compact" && value != "pretty") {
+                    throw std::invalid_argument(
+                        "option '--json' must be compact or pretty");
+                }
+                options.json.compact = value == "compact";
+            }},
+        {"json-precision", [](Options& options, std::string const& value)
+            {
+                options.json.precision =
+                    toBounded("json-precision", value, 0, 17);
+            }},
+        {"file-cache", [](Options& options, std::string const& value)
+            {
+                options.fileCache = toUnsigned("file-cache", value);
+            }}
+    };
+    return known;
+}
+
+} // namespace detail
+
+Options parseOptions(int argc, char** argv, int first)
+{
+    Options options;
+
+    for (int i = first; i < argc; ++i) {
+        std::string const argument = argv[i];
+
+        // Options have the form --name=value
+        auto const equal = argument.find('=');
+        if (argument.compare(0, 2, "--") != 0 ||
+            equal == std::string::npos) {
+            throw std::invalid_argument(
+                "invalid argument '" + argument + "'");
+        }
+
+        auto const name  = argument.substr(2, equal - 2);
+        auto const value = argument.substr(equal + 1);
+
+        // Shared with the client
+        if (net::parseDeflateOption(options.deflate, name, value)) continue;
+
+        auto const setter = detail::setters().find(name);
+        if (setter == detail::setters().end()) {
+            throw std::invalid_argument("unknown option '--" + name + "'");
+        }
+        setter->second(options, value);
+    }
+
+    return options;
+}
+
+std::string optionsUsage()
+{
+    return
+        "Options:\n"
+        "         --threads=<n>   number of I/O threads (default: 1)\n"
+        "         --shards=<n>    independent event loops, one thread each,\n"
+        "                         accepting with SO_REUSEPORT; overrides\n"
+        "                         --threads (default: 0, off)\n"
+        "         --broadcast-capacity=<n>\n"
+        "                         messages kept for slow sessions "
+        "(default: 1024)\n"
+        "         --coalesce-window=<us>\n"
+        "                         latency budget for sending broadcast "
+        "messages\n"
+        "                         together in one frame (default: 0, off)\n"
+        "         --coalesce-bytes=<n>\n"
+        "                         size budget of a coalesced frame "
+        "(default: 65536)\n"
+        "         --session-backlog=<n>\n"
+        "                         unsent messages allowed per session "
+        "(default: 0,\n"
+        "                         the broadcast capacity)\n"
+        "         --slow-consumer=<drop-oldest|latest|disconnect>\n"
+        "                         policy for sessions over the backlog "
+        "limit\n"
+        "                         (default: drop-oldest)\n" +
+        net::deflateUsage() +
+        "         --json=<compact|pretty>\n"
+        "                         layout of JSON messages (default: compact)\n"
+        "         --json-precision=<0-17>\n"
+        "                         significant digits of compact JSON numbers,"
+        "\n"
+        "                         0 for exact (default: 6)\n"
+        "         --file-cache=<n>\n"
+        "                         bytes of static files kept in memory,\n"
+        "                         0 to read from disk (default: 67108864)\n";
+}
+
+ADAPTIV_SERVER_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
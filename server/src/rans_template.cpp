@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) Nuno Alves de Sousa 2019
+ *
+ * Use, modification and distribution is subject to the Boost Software License,
+ * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+ * http://www.boost.org/LICENSE_1_0.txt)
+ */
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include <adaptiv/cloud/protocol/response.hpp>
+
+#include "rans_template.hpp"
+
+ADAPTIV_NAMESPACE_BEGIN
+ADAPTIV_CLOUD_NAMESPACE_BEGIN
+ADAPTIV_SERVER_NAMESPACE_BEGIN
+
+namespace solver {
+
+namespace {
+
+/// The JSON names of the numeric members of a RANSResponse (all unique)
+std::array<std::string_view, 8> constexpr keys{
+    "\"iteration\":",
+    "\"x\":", "\"y\":", "\"z\":", "\"energy\":", "\"tke\":", "\"tdr\":",
+    "\"busy\":"
+};
+
+/// The longest number: the shortest representation of a double
+std::size_t constexpr valueWidth = 24;
+
+/// Write a value as JSON, returning the end of the text
+template<class T>
+char* write(char* json, T value, int precision)
+{
+    auto const last = json + valueWidth;
+    if constexpr (std::is_same_v<T, bool>) {
+        std::string_view const text = value ? "true" : "false";
+        return std::copy(text.begin(), text.end(), json);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        if (!std::isfinite(value)) {
+            // As rapidjson with kWriteNanAndInfFlag (cereal's default)
+            std::string_view const text = std::isnan(value) ? "NaN" :
+                value < 0 ? "-Infinity" : "Infinity";
+            return std::copy(text.begin(), text.end(), json);
+        }
+        return (precision == 0 ?
+            std::to_chars(json, last, value) :
+            std::to_chars(json, last, value,
+                          std::chars_format::general, precision)).ptr;
+    } else {
+        return std::to_chars(json, last, value).ptr;
+    }
+}
+
+/// Write a value over its bytes in the portable binary format
+template<class T>
+char* patch(char* binary, T value)
+{
+    // The archive writes in the native byte order (and says so up front)
+    std::memcpy(binary, &value, sizeof(value));
+    return binary + sizeof(value);
+}
+
+} // namespace
+
+RANSTemplate::RANSTemplate(
+    std::string target,
+    protocol::JSONStyle const& style)
+    : target_(std::move(target))
+    , style_(style)
+    , precision_(style.compact ? std::clamp(style.precision, 0, 17) : 0)
+{
+    // Only the values of the slots change from one response to the next
+    protocol::RANSResponse const layout{};
+    protocol::Response response(target_, layout);
+
+    // [json] ------------------------------------------------------------ begin
+    // The text around the values, which are appended between the fragments
+    auto const rendered = response.json(style_);
+    std::size_t from = 0;
+    for (std::size_t i = 0; i < slots; ++i) {
+        auto const key = rendered.find(keys[i], from);
+        if (key == std::string::npos) {
+            throw std::logic_error(
+                "[adaptiv::server::RANSTemplate] unexpected layout");
+        }
+        auto const begin =
+            rendered.find_first_not_of(" \t\n", key + keys[i].size());
+        auto const end = rendered.find_first_of(",}\n", begin);
+
+        jsonFragments_[i].assign(rendered, from, begin - from);
+        jsonSize_ += jsonFragments_[i].size() + valueWidth;
+        from = end;
+    }
+    jsonFragments_[slots].assign(rendered, from, std::string::npos);
+    jsonSize_ += jsonFragments_[slots].size();
+    // [json] -------------------------------------------------------------- end
+
+    // [binary] ---------------------------------------------------------- begin
+    // The RANSResponse comes last: the iteration, six residuals, busy and
+    // the (empty) error string, i.e. its size
+    binary_ = response.binary();
+    binaryMessage_ = binary_.size() - (
+        sizeof(layout.iteration) + 6 * sizeof(double) +
+        sizeof(layout.busy) + sizeof(cereal::size_type));
+    // [binary] ------------------------------------------------------------ end
+}
+
+std::string RANSTemplate::encode(
+    protocol::RANSResponse const& result,
+    protocol::Format format) const
+{
+    std::string message;
+    encode(result, format, message);
+    return message;
+}
+
+void RANSTemplate::encode(
+    protocol::RANSResponse const& result,
+    protocol::Format format,
+    std::string& message) const
+{
+    if (!result.error.empty()) {
+        message = protocol::Response(target_, result).encode(format, style_);
+        return;
+    }
+
+    auto const& residuals = result.residuals;
+
+    if (format == protocol::Format::binary) {
+        message.assign(binary_);
+        auto binary = message.data() + binaryMessage_;
+        binary = patch(binary, result.iteration);
+        binary = patch(binary, residuals.momentum.x);
+        binary = patch(binary, residuals.momentum.y);
+        binary = patch(binary, residuals.momentum.z);
+        binary = patch(binary, residuals.energy);
+        binary = patch(binary, residuals.tke);
+        binary = patch(binary, residuals.tdr);
+        patch(binary, result.busy);
+        return;
+    }
+
+    message.clear();
+    message.reserve(jsonSize_);
+    auto json = [&](std::size_t slot, auto value) {
+        char text[valueWidth];
+        message += jsonFragments_[slot];
+        message.append(text, write(text, value, precision_));
+    };
+    json(0, result.iteration);
+    json(1, residuals.momentum.x);
+    json(2, residuals.momentum.y);
+    json(3, residuals.momentum.z);
+    json(4, residuals.energy);
+    json(5, residuals.tke);
+    json(6, residuals.tdr);
+    json(7, result.busy);
+    message += jsonFragments_[slots];
+}
+
+} // namespace solver
+
+ADAPTIV_SERVER_NAMESPACE_END
+ADAPTIV_CLOUD_NAMESPACE_END
+ADAPTIV_NAMESPACE_END
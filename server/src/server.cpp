@@ -5,13 +5,19 @@
  * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
  * http://www.boost.org/LICENSE_1_0.txt)
  */
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <limits>
+#include <string>
 #include <type_traits>
 #include <vector>
 #include <stdexcept>
 
 #include "server.hpp"
 #include "shared_state.hpp"
+#include "sendfile_body.hpp"
 #include "websocket_session.hpp"
 
 ADAPTIV_NAMESPACE_BEGIN
@@ -20,43 +26,6 @@ ADAPTIV_SERVER_NAMESPACE_BEGIN
 
 namespace detail {
 
-/// Return a reasonable mim type based on the extension of a file
-beast::string_view mimeType(beast::string_view path)
-{
-    using boost::beast::iequals;
-    auto const extension = [&path]
-    {
-        auto const pos = path.rfind(".");
-        if (pos == beast::string_view::npos) {
-            return beast::string_view{};
-        }
-        return path.substr(pos);
-    }();
-
-    if(iequals(extension, ".htm"))  return "text/html";
-    if(iequals(extension, ".html")) return "text/html";
-    if(iequals(extension, ".php"))  return "text/html";
-    if(iequals(extension, ".css"))  return "text/css";
-    if(iequals(extension, ".txt"))  return "text/plain";
-    if(iequals(extension, ".js"))   return "application/javascript";
-    if(iequals(extension, ".json")) return "application/json";
-    if(iequals(extension, ".xml"))  return "application/xml";
-    if(iequals(extension, ".swf"))  return "application/x-shockwave-flash";
-    if(iequals(extension, ".flv"))  return "video/x-flv";
-    if(iequals(extension, ".png"))  return "image/png";
-    if(iequals(extension, ".jpe"))  return "image/jpeg";
-    if(iequals(extension, ".jpeg")) return "image/jpeg";
-    if(iequals(extension, ".jpg"))  return "image/jpeg";
-    if(iequals(extension, ".gif"))  return "image/gif";
-    if(iequals(extension, ".bmp"))  return "image/bmp";
-    if(iequals(extension, ".ico"))  return "image/vnd.microsoft.icon";
-    if(iequals(extension, ".tiff")) return "image/tiff";
-    if(iequals(extension, ".tif"))  return "image/tiff";
-    if(iequals(extension, ".svg"))  return "image/svg+xml";
-    if(iequals(extension, ".svgz")) return "image/svg+xml";
-    return "application/text";
-}
-
 /// Append an HTTP rel-path to a local filesystem path.
 std::string pathConcatenate(beast::string_view base, beast::string_view path)
 {
@@ -88,13 +57,87 @@ std::string pathConcatenate(beast::string_view base, beast::string_view path)
     return result;
 }
 
+/// How the Range field of a request applies to a file (RFC 7233)
+enum class Range
+{
+    whole,        ///< No range (or an unsupported one): the whole file
+    partial,      ///< A single satisfiable byte range
+    unsatisfiable ///< The range starts past the end of the file
+};
+
+/**
+ * Parse the Range field of a request for a file of \c size bytes. Several
+ * ranges (i.e. multipart/byteranges) are not supported: the whole file is
+ * sent instead, as is for a malformed field
+ * @param[out] first The first byte of a partial range
+ * @param[out] last The last byte of a partial range (inclusive)
+ */
+Range parseRange(beast::string_view value, std::uint64_t size,
+                 std::uint64_t& first, std::uint64_t& last)
+{
+    beast::string_view const unit = "bytes=";
+    if (value.size() < unit.size() ||
+        !beast::iequals(value.substr(0, unit.size()), unit)) {
+        return Range::whole;
+    }
+    value.remove_prefix(unit.size());
+
+    auto const dash = value.find('-');
+    if (dash == beast::string_view::npos ||
+        value.find(',') != beast::string_view::npos) {
+        return Range::whole;
+    }
+
+    // Decimal digits (an empty position is left to the caller)
+    auto const toNumber = [](beast::string_view digits, std::uint64_t& number)
+    {
+        number = 0;
+        for (auto const c : digits) {
+            if (c < '0' || c > '9') return false;
+            if (number > (std::numeric_limits<std::uint64_t>::max() - 9) / 10) {
+                return false;
+            }
+            number = number * 10 + static_cast<std::uint64_t>(c - '0');
+        }
+        return true;
+    };
+
+    auto const head = value.substr(0, dash);
+    auto const tail = value.substr(dash + 1);
+    std::uint64_t start = 0;
+    std::uint64_t end = 0;
+    if (!toNumber(head, start) || !toNumber(tail, end)) return Range::whole;
+
+    // The last bytes of the file, e.g. "bytes=-500"
+    if (head.empty()) {
+        if (tail.empty()) return Range::whole;
+        if (end == 0 || size == 0) return Range::unsatisfiable;
+        first = size - std::min(end, size);
+        last = size - 1;
+        return Range::partial;
+    }
+
+    // From a byte to another, or to the end, e.g. "bytes=500-"
+    if (!tail.empty() && end < start) return Range::whole;
+    if (start >= size) return Range::unsatisfiable;
+    first = start;
+    last = tail.empty() ? size - 1 : std::min(end, size - 1);
+    return Range::partial;
+}
+
 /**
  * Produce an HTTP response for the given request. The type of he response
  * object depends on the contents of the request, so the interface requires the
- * caller to pass a generic lambda for receiving the response.
+ * caller to pass a generic lambda for receiving the response (a coroutine
+ * that writes it).
+ * @note Files are served from memory (see FileCache), with the coding the
+ * client accepts, and revalidated with their entity tags; the response
+ * refers to the cached file, so \c send must write it before returning.
+ * Other files are sent from disk (see SendfileBody), whole or a byte range.
  */
 template<class Body, class Allocator, class Send>
-void handleRequest(
+awaitable_t<> handleRequest(
+    FileCache& files,
     beast::string_view documentRoot,
     beast::http::request<Body, beast::http::basic_fields<Allocator>>&& request,
     Send&& send)
@@ -146,89 +189,222 @@ void handleRequest(
     // Make sure we can handle the method
     if (request.method() != beast::http::verb::get &&
         request.method() != beast::http::verb::head) {
-        return send(badRequest("Unknown HTTP-method"));
+        co_return co_await send(badRequest("Unknown HTTP-method"));
     }
 
     // Request path must be absolute and not contain "..".
     if (request.target().empty() ||
         request.target()[0] != '/' ||
         request.target().find("..") != beast::string_view::npos) {
-        return send(badRequest("Illegal request-target"));
+        co_return co_await send(badRequest("Illegal request-target"));
     }
 
     // Build the path to the requested file
     std::string path = detail::pathConcatenate(documentRoot, request.target());
     if (request.target().back() == '/') path.append("index.html");
 
-    // Attempt to open the file
+    // Look the file up in memory
     boost::beast::error_code ec;
-    beast::http::file_body::value_type body;
-    body.open(path.c_str(), beast::file_mode::scan, ec);
+    auto const entry = files.find(path, ec);
+
+    // Handle the case where the file doesn't exist
+    if (ec == boost::system::errc::no_such_file_or_directory) {
+        co_return co_await send(notFound(request.target()));
+    }
+
+    // Handle an unknown error
+    if (ec) co_return co_await send(serverError(ec.message()));
+
+    if (entry) {
+        auto const& variant = entry->negotiate(
+            request[beast::http::field::accept_encoding]);
+
+        // The validators and caching policy of every response of the file
+        auto const validators = [&](auto& response)
+        {
+            response.set(beast::http::field::server, ADAPTIV_VERSION_STRING);
+            response.set(beast::http::field::etag, variant.etag);
+            response.set(beast::http::field::cache_control, "no-cache");
+            if (entry->isCompressed) {
+                response.set(beast::http::field::vary, "Accept-Encoding");
+            }
+            response.keep_alive(request.keep_alive());
+        };
+
+        // The representation the client has is still current
+        if (FileCache::matches(request[beast::http::field::if_none_match],
+                               variant.etag)) {
+            beast::http::response<beast::http::empty_body>
+                response{beast::http::status::not_modified, request.version()};
+            validators(response);
+            co_return co_await send(std::move(response));
+        }
+
+        auto const content = [&](auto& response)
+        {
+            validators(response);
+            response.set(beast::http::field::content_type, entry->mime);
+            auto const coding = entry->coding(variant);
+            if (coding != FileCache::Coding::identity) {
+                response.set(beast::http::field::content_encoding,
+                             FileCache::name(coding));
+            }
+            response.content_length(variant.body.size());
+        };
+
+        // Respond to HEAD request
+        if (request.method() == beast::http::verb::head) {
+            beast::http::response<beast::http::empty_body>
+                response{beast::http::status::ok, request.version()};
+            content(response);
+            co_return co_await send(std::move(response));
+        }
+
+        // Respond to GET request (the body refers to the cached file)
+        beast::http::response<beast::http::span_body<char const>>
+            response{std::piecewise_construct,
+                     std::make_tuple(variant.body.data(), variant.body.size()),
+                     std::make_tuple(beast::http::status::ok,
+                                     request.version())};
+        content(response);
+
+        std::cout << "[sent] " << request.target() << '\n'; // For debugging
+
+        co_return co_await send(std::move(response));
+    }
+
+    // Not kept in memory (e.g. large result files): sent from disk
+    std::error_code stat;
+    auto const modified = std::filesystem::last_write_time(path, stat);
+    if (!stat && std::filesystem::is_directory(path, stat)) {
+        co_return co_await send(notFound(request.target()));
+    }
+
+    // Attempt to open the file
+    SendfileBody::value_type body;
+    body.open(path.c_str(), ec);
 
     // Handle the case where the file doesn't exist
     if (ec == boost::system::errc::no_such_file_or_directory) {
-        return send(notFound(request.target()));
+        co_return co_await send(notFound(request.target()));
     }
 
     // Handle an unknown error
-    if (ec) return send(serverError(ec.message()));
+    if (ec) co_return co_await send(serverError(ec.message()));
+
+    auto const size = body.fileSize();
+    auto const etag = FileCache::entityTag(size, modified);
+
+    // The validators of every response of the file
+    auto const validators = [&](auto& response)
+    {
+        response.set(beast::http::field::server, ADAPTIV_VERSION_STRING);
+        response.set(beast::http::field::etag, etag);
+        response.set(beast::http::field::accept_ranges, "bytes");
+        response.keep_alive(request.keep_alive());
+    };
+
+    // The file the client has is still current
+    if (FileCache::matches(request[beast::http::field::if_none_match], etag)) {
+        beast::http::response<beast::http::empty_body>
+            response{beast::http::status::not_modified, request.version()};
+        validators(response);
+        co_return co_await send(std::move(response));
+    }
+
+    // Resume a download: a range of the file, unless it changed (If-Range)
+    std::uint64_t first = 0;
+    std::uint64_t last = 0;
+    auto range = Range::whole;
+    auto const ifRange = request[beast::http::field::if_range];
+    if (ifRange.empty() || ifRange == etag) {
+        range = parseRange(
+            request[beast::http::field::range], size, first, last);
+    }
+
+    if (range == Range::unsatisfiable) {
+        beast::http::response<beast::http::empty_body>
+            response{beast::http::status::range_not_satisfiable,
+                     request.version()};
+        validators(response);
+        response.set(beast::http::field::content_range,
+                     "bytes */" + std::to_string(size));
+        response.content_length(0);
+        co_return co_await send(std::move(response));
+    }
+
+    auto const result = range == Range::partial ?
+        beast::http::status::partial_content : beast::http::status::ok;
+    if (range == Range::partial) body.range(first, last);
 
     // Cache the size since we need it after the move
-    auto const size = body.size();
+    auto const length = body.size();
+
+    auto const content = [&](auto& response)
+    {
+        validators(response);
+        response.set(beast::http::field::content_type, mimeType(path));
+        if (range == Range::partial) {
+            response.set(beast::http::field::content_range,
+                         "bytes " + std::to_string(first) + '-' +
+                         std::to_string(last) + '/' + std::to_string(size));
+        }
+        response.content_length(length);
+    };
 
     // Respond to HEAD request
     if (request.method() == beast::http::verb::head) {
         beast::http::response<beast::http::empty_body>
-            response{beast::http::status::ok, request.version()};
-        response.set(beast::http::field::server, ADAPTIV_VERSION_STRING);
-        response.set(beast::http::field::content_type, mimeType(path));
-        response.content_length(size);
-        response.keep_alive(request.keep_alive());
-        return send(std::move(response));
+            response{result, request.version()};
+        content(response);
+        co_return co_await send(std::move(response));
     }
 
     // Respond to GET request
-    beast::http::response<beast::http::file_body>
+    beast::http::response<SendfileBody>
         response{std::piecewise_construct,
                  std::make_tuple(std::move(body)),
-                 std::make_tuple(beast::http::status::ok, request.version())};
-    response.set(beast::http::field::server, ADAPTIV_VERSION_STRING);
-    response.set(beast::http::field::content_type, mimeType(path));
-    response.content_length(size);
-    response.keep_alive(request.keep_alive());
+                 std::make_tuple(result, request.version())};
+    content(response);
 
     std::cout << "[sent] " << request.target() << '\n'; // For debugging
 
-    return send(std::move(response));
+    co_return co_await send(std::move(response));
 }
 
 /// Handles a WebSocketSession
 template<class Body, class Allocator>
-void doWebSocketSession(
-    net::tcp::socket&& socket,
-    std::shared_ptr<SharedState> const& state,
+awaitable_t<> doWebSocketSession(
+    stream_t::socket_type socket,
+    std::shared_ptr<SharedState> state,
     beast::http::request<Body
-                        ,boost::beast::http::basic_fields<Allocator>> request,
-    net::yield_context yield)
+                        ,boost::beast::http::basic_fields<Allocator>> request)
 {
     // Create a WebSocketSession and accept the handshake
     auto session = WebSocketSession::makeShared(std::move(socket), state);
-    auto ec = session->accept(request, yield);
-    if (ec) return fail(ec, "websocket accept");
+    auto ec = co_await session->accept(std::move(request));
+    if (ec) co_return fail(ec, "websocket accept");
 
     // Send welcome message
-    session->welcome(yield);
+    co_await session->welcome();
 
-    while (session->hasConnection()) {
-        session->run(yield);
+    co_await session->run();
+
+    auto const& sent = session->counters();
+    if (sent.saved() > 0) {
+        ADAPTIV_DEBUG_CERR("coalesced(id:" << session.get() << ", messages:" <<
+            sent.messages << ", frames:" << sent.frames << ')');
+    }
+    if (sent.dropped > 0) {
+        ADAPTIV_DEBUG_CERR("dropped(id:" << session.get() << ", messages:" <<
+            sent.dropped << ", high-water:" << sent.highWater << ')');
     }
 }
 
 /// Handles an HTTP server connection
-void doHttpSession(
-    beast::tcp_stream&& stream,
-    std::shared_ptr<SharedState> const& state,
-    net::yield_context yield)
+awaitable_t<> doHttpSession(
+    stream_t stream,
+    std::shared_ptr<SharedState> state)
 {
     bool close = false;
     error_code ec;
@@ -242,47 +418,50 @@ void doHttpSession(
 
         // Read a request
         beast::http::request<beast::http::string_body> request;
-        beast::http::async_read(stream, buffer, request, yield[ec]);
+        co_await beast::http::async_read(stream, buffer, request,
+                                         redirect(ec));
         if (ec == beast::http::error::end_of_stream) break; // They closed
-        if (ec) return fail(ec, "run");
+        if (ec) co_return fail(ec, "run");
 
         // --- WebSocket (check if it is an upgrade)
         if (beast::websocket::is_upgrade(request)) {
-            net::spawn(
-                stream.get_executor(),
-                [&stream, &request, state](net::yield_context yield)
-                {
-                    detail::doWebSocketSession(
-                        stream.release_socket(),
-                        state,
-                        std::move(request),
-                        yield);
-                });
-            return;
+            // The WebSocketSession takes over the connection and keeps
+            // running on the strand of this HTTP session
+            co_return co_await detail::doWebSocketSession(
+                stream.release_socket(),
+                state,
+                std::move(request));
         }
 
         // --- HTTP response
-        handleRequest(state->documentRoot(), std::move(request),
-            [&stream, &close, &ec, &yield](auto&& response)
+        co_await handleRequest(state->files(), state->documentRoot(),
+            std::move(request),
+            [&stream, &close, &ec](auto response) -> awaitable_t<>
             {
                 // Determine if we need to close the connection after
                 close = response.need_eof();
 
                 // We need the serializer here because the serializer requires
-                // a non-const file_body, and the message oriented version of
-                // http::write only works with const messages.
+                // a non-const body (e.g. a file), and the message oriented
+                // version of http::write only works with const messages.
                 using response_type = typename std::decay_t<decltype(response)>;
                 bool constexpr isRequest = response_type::is_request::value;
                 using body_type = typename response_type::body_type;
                 using fields_type = typename response_type::fields_type;
 
-                beast::http::serializer<isRequest
-                                       ,body_type
-                                       ,fields_type> serial(response);
-                beast::http::async_write(stream, serial, yield[ec]);
+                // Files from disk are sent by the kernel
+                if constexpr (std::is_same_v<body_type, SendfileBody>) {
+                    ec = co_await sendFile(stream, response);
+                } else {
+                    beast::http::serializer<isRequest
+                                           ,body_type
+                                           ,fields_type> serial(response);
+                    co_await beast::http::async_write(stream, serial,
+                                                      redirect(ec));
+                }
             });
 
-        if (ec) return fail(ec, "write");
+        if (ec) co_return fail(ec, "write");
 
         if (close) {
             // This means we should close the connection, usally because the
@@ -299,49 +478,60 @@ void doHttpSession(
 
 } // namespace external
 
-void doListen(
+net::awaitable<void> doListen(
     net::io_context& context,
     net::tcp::endpoint endpoint,
-    std::shared_ptr<SharedState> const& state,
-    boost::asio::yield_context yield)
+    std::shared_ptr<SharedState> state)
 {
     error_code ec;
 
     // Open the acceptor
     net::tcp::acceptor acceptor(context);
     acceptor.open(endpoint.protocol(), ec);
-    if (ec) return fail(ec, "open");
+    if (ec) co_return fail(ec, "open");
 
     // Allow address reuse
     acceptor.set_option(net::socket_base::reuse_address(true), ec);
-    if (ec) return fail(ec, "set_option");
+    if (ec) co_return fail(ec, "set_option");
+
+    // Shards bind the same port: the kernel balances the connections
+    if (state->options().shards > 0) {
+#if defined(SO_REUSEPORT)
+        using reuse_port = boost::asio::detail::socket_option::boolean<
+            SOL_SOCKET, SO_REUSEPORT>;
+        acceptor.set_option(reuse_port(true), ec);
+        if (ec) co_return fail(ec, "set_option");
+#else
+        co_return fail(net::error::operation_not_supported, "SO_REUSEPORT");
+#endif
+    }
 
     // Bind to the server address
     acceptor.bind(endpoint, ec);
-    if (ec) return fail(ec, "bind");
+    if (ec) co_return fail(ec, "bind");
 
     // Start listening for connections
     acceptor.listen(net::socket_base::max_listen_connections, ec);
-    if (ec) return fail(ec, "listen");
+    if (ec) co_return fail(ec, "listen");
 
     while (true) {
+        // Every connection gets its own strand: sessions run concurrently on
+        // the I/O threads while the handlers of each session are serialized
+        auto strand = net::make_strand(context);
+
         // The socket performs the I/O
-        net::tcp::socket socket(context);
+        stream_t::socket_type socket(strand);
 
         // Accept the connection
-        acceptor.async_accept(socket, yield[ec]);
-        if (ec) return fail(ec, "accept");
-
-        // Launch a new HTTP session
-        net::spawn(
-            acceptor.get_executor(),
-            [&socket, state](net::yield_context yield)
-            {
-                detail::doHttpSession(
-                    beast::tcp_stream(std::move(socket)),
-                    state,
-                    yield);
-            });
+        co_await acceptor.async_accept(
+            socket, net::redirect_error(net::use_awaitable, ec));
+        if (ec) co_return fail(ec, "accept");
+
+        // Launch a new HTTP session (the socket is moved into the coroutine)
+        net::co_spawn(
+            strand,
+            detail::doHttpSession(stream_t(std::move(socket)), state),
+            net::detached);
     }
 }
 
@@ -5,6 +5,13 @@
  * Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
  * http://www.boost.org/LICENSE_1_0.txt)
  */
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
 #include "shared_state.hpp"
 #include "websocket_session.hpp"
 
@@ -12,12 +19,89 @@ ADAPTIV_NAMESPACE_BEGIN
 ADAPTIV_CLOUD_NAMESPACE_BEGIN
 ADAPTIV_SERVER_NAMESPACE_BEGIN
 
-SharedState::SharedState(net::io_context& context,  std::string documentRoot)
-    : context_(context)
-    , documentRoot_(std::move(documentRoot))
-    , ransSolver_(this)
+namespace {
+
+/// The read buffers kept for new sessions
+std::size_t constexpr readBuffersKept = 256;
+
+} // namespace
+
+SharedState::Shard::Shard(net::io_context& context)
+    : context(context)
+    , sessions(new registry_t())
+{ }
+
+SharedState::Shard::~Shard()
+{
+    delete sessions.load();
+}
+
+void SharedState::Shard::replace(std::unique_ptr<registry_t const> updated)
+{
+    // Readers that arrive from now on load the new list
+    retired.push_back({epoch.load(), std::unique_ptr<registry_t const>(
+        sessions.exchange(updated.release()))});
+    hasRetired.store(true);
+    reclaim();
+}
+
+void SharedState::Shard::reclaim() noexcept
+{
+    // Each step checks the readers of one parity: two steps after a
+    // snapshot was replaced, both have been seen without the readers that
+    // loaded it (they announce themselves before loading it)
+    for (int step = 0; step < 2; ++step) {
+        auto const current = epoch.load();
+        if (readers[(current + 1) & 1].load() != 0) break;
+        epoch.store(current + 1);
+    }
+
+    auto const current = epoch.load();
+    auto const last = std::find_if(retired.begin(), retired.end(),
+        [current](Retired const& entry) { return entry.epoch + 2 > current; });
+    retired.erase(retired.begin(), last);
+    hasRetired.store(!retired.empty());
+}
+
+void SharedState::Shard::endRead(std::size_t parity) noexcept
+{
+    if (readers[parity].fetch_sub(1) != 1 || !hasRetired.load()) return;
+
+    std::unique_lock lock(registryMutex, std::try_to_lock);
+    if (lock) reclaim();
+}
+
+SharedState::SharedState(
+    net::io_context& context,
+    std::string documentRoot,
+    Options options)
+    : SharedState(contexts_t{context},
+                  std::move(documentRoot),
+                  std::move(options))
 { }
 
+SharedState::SharedState(
+    contexts_t const& contexts,
+    std::string documentRoot,
+    Options options)
+    : ransSolver_(this)
+    , documentRoot_(std::move(documentRoot))
+    , options_(std::move(options))
+    , files_(options_.fileCache)
+    , broadcast_(options_.broadcastCapacity)
+    , readBuffers_(readBuffersKept)
+{
+    shards_.reserve(contexts.size());
+    for (auto& context : contexts) {
+        shards_.push_back(std::make_unique<Shard>(context.get()));
+    }
+
+#if defined(__linux__)
+    CPU_ZERO(&cores_);
+    sched_getaffinity(0, sizeof(cores_), &cores_);
+#endif
+}
+
 SharedState::~SharedState()
 {
     // The solver might still be running, so join here
@@ -26,53 +110,86 @@ SharedState::~SharedState()
     }
 }
 
-void SharedState::join(WebSocketSession* session)
+SharedState::Shard& SharedState::shard(net::io_context& context)
 {
-    std::lock_guard guard(mutex_);
-    sessions_.insert(session);
-    ADAPTIV_DEBUG_CERR("join(id" << session << ')');
+    // A handful of shards, fixed at startup
+    for (auto& shard : shards_) {
+        if (&shard->context == &context) return *shard;
+    }
+    throw std::logic_error(
+        "[adaptiv::server::SharedState] the io_context is not a shard");
 }
 
-void SharedState::leave(WebSocketSession* session)
+void SharedState::join(std::shared_ptr<WebSocketSession> const& session)
 {
-    std::lock_guard guard(mutex_);
-    sessions_.erase(session);
-    ADAPTIV_DEBUG_CERR("left(id" << session << ')');
+    auto& shard = this->shard(session->context());
+    std::lock_guard guard(shard.registryMutex);
+
+    auto updated = std::make_unique<registry_t>(*shard.sessions.load());
+    updated->emplace_back(session);
+    shard.replace(std::move(updated));
+
+    ADAPTIV_DEBUG_CERR("join(id" << session.get() << ')');
 }
 
-void SharedState::push(std::string message)
+void SharedState::leave(WebSocketSession* session)
 {
-    // Put a message in a shared pointer so we can use it in multiple queues
-    auto const messageSPtr =
-        std::make_shared<std::string const>(std::move(message));
+    auto& shard = this->shard(session->context());
+    std::lock_guard guard(shard.registryMutex);
 
-    // Flush the queue by writing its contents to the underlying websocket
-    for (auto session : sessions_) {
-        session->queue_.push(messageSPtr);
-        net::spawn(session->websocket_.get_executor(),
-            [session](net::yield_context yield)
-            {
-                session->write(yield);
-            });
+    // The leaving session has expired: drop every expired entry
+    auto const& current = *shard.sessions.load();
+    auto updated = std::make_unique<registry_t>();
+    updated->reserve(current.size());
+    for (auto const& entry : current) {
+        if (!entry.expired()) updated->push_back(entry);
     }
+    shard.replace(std::move(updated));
+
+    ADAPTIV_DEBUG_CERR("left(id" << session << ')');
 }
 
-void SharedState::enqueue(std::string message)
+void SharedState::publish(MessagePool::value_type message)
 {
-    // Put a message in a shared pointer so we can use it in multiple queues
-    auto const messageSPtr =
-               std::make_shared<std::string const>(std::move(message));
+    // Written once, read by every session (which serializes it on demand)
+    broadcast_.publish(std::move(message));
+    notify();
+}
 
-    std::lock_guard guard(mutex_);
-    for (auto session : sessions_) {
-        session->queue_.push(messageSPtr);
+void SharedState::notify()
+{
+    // The caller (i.e. the solver) pays for a single post per shard, if any:
+    // the pending fan-out also covers what is published before it runs
+    for (auto& shard : shards_) {
+        if (shard->isNotifying.exchange(true, std::memory_order_acq_rel)) {
+            continue;
+        }
+
+        net::post(shard->context,
+            [self = shared_from_this(), shard = shard.get()]
+            {
+                // Publications from now on need a fan-out of their own
+                shard->isNotifying.exchange(false, std::memory_order_acq_rel);
+
+                shard->forEach([](auto const& entry)
+                    {
+                        if (auto session = entry.lock()) {
+                            session->notify();
+                        }
+                    });
+            });
     }
 }
 
 void SharedState::isBusy(bool set)
 {
-    std::lock_guard guard(mutex_);
-    isBusy_ = set;
+    {
+        std::lock_guard guard(mutex_);
+        isBusy_ = set;
+    }
+
+    // Sessions waiting for the solver need to know it has finished
+    if (!set) notify();
 }
 
 bool SharedState::isBusy()
@@ -81,22 +198,53 @@ bool SharedState::isBusy()
     return isBusy_;
 }
 
-void SharedState::solve()
+bool SharedState::solve()
 {
-    // If the solver was running previously, join so that we can launch again
-    if (!isBusy() && solverThread_.joinable()) {
+    // Sessions run concurrently: only the first request launches the solver
+    std::lock_guard guard(mutex_);
+    if (isBusy_) return false;
+
+    // The solver was running previously, join so that we can launch again.
+    // It no longer needs the mutex since it has already cleared isBusy_
+    if (solverThread_.joinable()) {
         solverThread_.join();
     }
 
     isBusy_ = true;
-    solverThread_ = std::thread(&solver::RANS::run, &ransSolver_);
+    solverThread_ = std::thread([this]
+        {
+#if defined(__linux__)
+            // Best effort: otherwise it shares the core of a shard
+            if (CPU_COUNT(&cores_) > 0) {
+                pthread_setaffinity_np(pthread_self(), sizeof(cores_),
+                                       &cores_);
+            }
+#endif
+            ransSolver_.run();
+        });
+    return true;
 }
 
 std::shared_ptr<SharedState> SharedState::makeShared(
     net::io_context& context,
-    std::string documentRoot)
+    std::string documentRoot,
+    Options options)
+{
+    return std::make_shared<SharedState>(
+        context,
+        std::move(documentRoot),
+        std::move(options));
+}
+
+std::shared_ptr<SharedState> SharedState::makeShared(
+    contexts_t const& contexts,
+    std::string documentRoot,
+    Options options)
 {
-    return std::make_shared<SharedState>(context, std::move(documentRoot));
+    return std::make_shared<SharedState>(
+        contexts,
+        std::move(documentRoot),
+        std::move(options));
 }
 
 ADAPTIV_SERVER_NAMESPACE_END
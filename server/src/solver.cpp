@@ -37,7 +37,8 @@ void RANS::update()
     std::this_thread::sleep_for(iterationTime_); // Simulate runtime
 }
 
-std::string RANS::response()
+RANS::Response RANS::response(
+    std::shared_ptr<RANSTemplate const> layout) const
 {
     protocol::RANSResponse result {
         iteration_,
@@ -57,8 +58,8 @@ std::string RANS::response()
         ""
     };
 
-    cloud::protocol::Response response("solve", result);
-    return response.json();
+    // Only the payload is kept: nothing is serialized until needed
+    return {std::move(layout), std::move(result)};
 }
 
 RANS::RANS(
@@ -73,12 +74,18 @@ RANS::RANS(
 
 void RANS::run()
 {
+    // Serialized once: each response only rewrites the numbers
+    auto const layout = std::make_shared<RANSTemplate const>(
+        "solve", state_->options().json);
+
     while (iteration_ < maxIterations_) {
         update();
 
-        // Push payload to the queue of each active session
-        state_->enqueue(response());
-        ADAPTIV_DEBUG_CERR(response());
+        // Publish payload to the broadcast log read by every session
+        auto message = response(layout);
+        ADAPTIV_DEBUG_CERR("solve(iteration:" << message.result.iteration <<
+            ", energy:" << message.result.residuals.energy << ')');
+        state_->enqueue(std::move(message));
     }
 //    state_->enqueue("{result:solverFinished}");
     state_->isBusy(false);
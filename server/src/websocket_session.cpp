@@ -12,21 +12,45 @@
 #include <string>
 #include <sstream>
 #include <algorithm>
+#include <vector>
+#include <exception>
+#include <string_view>
 
-#include <adaptiv/cloud/protocol/response.hpp>
+#include <adaptiv/cloud/protocol/inbound.hpp>
+#include <adaptiv/cloud/protocol/router.hpp>
 #include <adaptiv/cloud/protocol/messages/server_status.hpp>
+#include <adaptiv/cloud/protocol/messages/rans.hpp>
 
 ADAPTIV_NAMESPACE_BEGIN
 ADAPTIV_CLOUD_NAMESPACE_BEGIN
 ADAPTIV_SERVER_NAMESPACE_BEGIN
 
+namespace {
+
+/// The most memory a read buffer keeps for the next session
+std::size_t constexpr readBufferKept = 64 * 1024;
+
+} // namespace
+
 WebSocketSession::WebSocketSession(
-    net::tcp::socket&& socket,
+    stream_t::socket_type&& socket,
     std::shared_ptr<SharedState> state)
     : websocket_(std::move(socket))
     , state_(std::move(state))
+    , signal_(websocket_.get_executor(), net::steady_timer::time_point::max())
+    , drained_(websocket_.get_executor(), net::steady_timer::time_point::max())
+    , cursor_(state_->broadcast().head())
+    , backlogLimit_(
+        state_->options().sessionBacklog == 0 ?
+            state_->broadcast().capacity() :
+            std::min(state_->options().sessionBacklog,
+                     state_->broadcast().capacity()))
 {
-    state_->join(this);
+    // Whole messages are written at once: do not hold back the tail of a
+    // reply (e.g. the last fragment of a batch) until the client acks
+    error_code ec;
+    beast::get_lowest_layer(websocket_).socket().set_option(
+        net::tcp::no_delay(true), ec);
 }
 
 WebSocketSession::~WebSocketSession()
@@ -34,170 +58,405 @@ WebSocketSession::~WebSocketSession()
     state_->leave(this);
 }
 
-void WebSocketSession::message(
-    std::string const& msg,
-    boost::asio::yield_context yield)
+awaitable_t<> WebSocketSession::message(std::string const& msg)
 {
     error_code ec;
-    websocket_.async_write(net::buffer(msg), yield[ec]);
-    if (ec) return fail(ec, "websocket welcome");
-}
-
-bool WebSocketSession::queueEmpty()
-{
-    std::lock_guard guard(state_->mutex());
-    return queue_.empty();
-}
-
-std::shared_ptr<std::string const>& WebSocketSession::queueFront()
-{
-    std::lock_guard guard(state_->mutex());
-    return queue_.front();
+    co_await websocket_.async_write(net::buffer(msg), redirect(ec));
+    if (ec) co_return fail(ec, "websocket welcome");
 }
 
-void WebSocketSession::queuePop()
+bool WebSocketSession::hasPending() const
 {
-    std::lock_guard guard(state_->mutex());
-    queue_.pop();
+    return cursor_ < state_->broadcast().head();
 }
 
-void WebSocketSession::queueClear()
+bool WebSocketSession::catchUp()
 {
-    std::lock_guard guard(state_->mutex());
-    std::queue<std::shared_ptr<std::string const>> empty;
-    std::swap(queue_, empty);
+    auto const head = state_->broadcast().head();
+    auto const backlog = static_cast<std::size_t>(head - cursor_);
+    counters_.highWater = std::max(counters_.highWater, backlog);
+
+    if (backlog <= backlogLimit_) return true;
+
+    switch (state_->options().slowConsumer) {
+    case SlowConsumerPolicy::dropOldest:
+        counters_.dropped += backlog - backlogLimit_;
+        cursor_ = head - backlogLimit_;
+        return true;
+    case SlowConsumerPolicy::latest:
+        // The latest message supersedes the ones before it; the final
+        // message of a run is always the latest once the solver finishes
+        counters_.dropped += backlog - 1;
+        cursor_ = head - 1;
+        return true;
+    case SlowConsumerPolicy::disconnect:
+        isTooSlow_ = true;
+        return false;
+    }
+    return true;
 }
 
-std::queue<std::shared_ptr<std::string const>> WebSocketSession::queueCopy()
+WebSocketSession::ring_t::value_type WebSocketSession::next()
 {
-    std::queue<std::shared_ptr<std::string const>>  tempQueue;
-    {
-        std::lock_guard guard(state_->mutex());
-        tempQueue = queue_;
+    auto const& broadcast = state_->broadcast();
+
+    ring_t::value_type message;
+    while (catchUp()) {
+        switch (broadcast.read(cursor_, message)) {
+        case ring_t::Status::ok:
+            ++cursor_;
+            return message;
+        case ring_t::Status::empty:
+            return nullptr;
+        case ring_t::Status::lapped:
+            // Too slow: the message was overwritten after catchUp() checked
+            ADAPTIV_DEBUG_CERR("lapped(id:" << this << ')');
+            ++counters_.dropped;
+            ++cursor_;
+            break;
+        }
     }
-    return tempQueue;
+    return nullptr;
 }
 
-void WebSocketSession::welcome(boost::asio::yield_context yield)
+std::string WebSocketSession::status(
+    std::string error,
+    protocol::id_t id) const
 {
     protocol::responses::ServerStatus status{
         state_->isBusy(),
         state_->isBusy()? "rans" : "",  // Active target
-        ""                              // No errors for now
+        std::move(error)
     };
-    protocol::Response response("status", status);
+    return protocol::Response("status", status, id).encode(
+        format_, options().json);
+}
 
-    ADAPTIV_DEBUG_CERR(response.json());
+awaitable_t<> WebSocketSession::welcome()
+{
+    auto response = status();
+    ADAPTIV_DEBUG_CERR("welcome(id:" << this << ", format:" <<
+        protocol::subprotocol(format_) << ')');
 
-    message(response.json(), yield);
+    co_await message(response);
 }
 
-void WebSocketSession::write(boost::asio::yield_context yield)
+void WebSocketSession::reply(std::string message)
 {
-    ADAPTIV_DEBUG_CERR("->write(id:" << this << ')');
+    control_.push_back(std::move(message));
+    signal_.cancel();
+}
 
-    error_code ec;
+void WebSocketSession::handle(beast::flat_buffer& buffer)
+{
+    auto const data = buffer.data();
+    if (command({static_cast<char const*>(data.data()), data.size()})) {
+        return;
+    }
+
+    // A single request, or a batch of them
+    protocol::Inbound inbound(buffer, format_);
+    std::vector<std::string> replies;
+    while (!inbound.done()) {
+        replies.push_back(dispatch(inbound));
+    }
+
+    if (inbound.isBatch()) return reply(protocol::batch(replies));
+
+    // Binary replies are self-delimiting: send them back to back
+    std::string response;
+    for (auto const& item : replies) {
+        response += item;
+    }
+    if (!response.empty()) reply(std::move(response));
+}
 
-    while (!queueEmpty()) {
-        // Send the message
-        auto msg = *queueFront();
-        websocket_.async_write(net::buffer(msg), yield[ec]);
-        if (ec) return fail(ec, "websocket write");
+std::string WebSocketSession::dispatch(protocol::Inbound& inbound)
+{
+    static constexpr auto router = protocol::makeRouter(
+        protocol::route("status", &WebSocketSession::onStatus),
+        protocol::route("solve",  &WebSocketSession::onSolve));
+
+    auto const header = inbound.header();
+
+    // Reject malformed messages up front, rather than partway through
+    // reconstructing them (i.e. from an exception)
+    if (auto const error = router.validate(inbound); !error.empty()) {
+        ADAPTIV_DEBUG_CERR(this << ":" << error);
+        inbound.skip();
+        return status("invalid request: " + error, header.id);
+    }
 
-        // Remove what we just sent
-        queuePop();
+    try {
+        if (auto reply = router.dispatch(inbound, this)) {
+            return std::move(*reply);
+        }
+    } catch (std::exception const& exception) {
+        // The message does not match the target
+        ADAPTIV_DEBUG_CERR(this << ":" << exception.what());
+        return status("invalid request", header.id);
     }
-    ADAPTIV_DEBUG_CERR("<-write(id:" << this << ')');
+
+    inbound.skip();
+    return header.target.empty() ?
+        status("invalid request", header.id) :
+        status("unknown target: " + header.target, header.id);
 }
 
-void WebSocketSession::flush(boost::asio::yield_context yield)
+std::string WebSocketSession::onStatus(
+    protocol::Request<protocol::requests::ServerStatus> const& request)
 {
-    ADAPTIV_DEBUG_CERR("->flush(id:" << this << ')');
-    isFlushing_ = true;
+    return status("", request.id());
+}
+
+std::string WebSocketSession::onSolve(
+    protocol::Request<protocol::RANSRequest> const& request)
+{
+    if (state_->solve()) {
+        ADAPTIV_DEBUG_CERR("starting solver...");
+    }
+    return status("", request.id());
+}
 
-    // Copy and clear - freeing queue_ before yielding;
-    auto tempQueue = queueCopy();
-    queueClear();
+bool WebSocketSession::command(std::string_view request)
+{
+    if (request == "solve") {
+        if (state_->solve()) {
+            ADAPTIV_DEBUG_CERR("starting solver...");
+        } else {
+            // Already solving: the client gets the ongoing solve instead
+            reply(status());
+        }
+    } else if (request == "status") {
+        reply(status());
+    } else {
+        return false;
+    }
+    return true;
+}
 
+awaitable_t<> WebSocketSession::read()
+{
     error_code ec;
-    while (!tempQueue.empty()) {
-        websocket_.async_write(net::buffer(*tempQueue.front()), yield[ec]);
+
+    // This buffer will hold the incoming message: a recycled one, given back
+    // (with the memory it grew, within bounds) when the session closes
+    auto const recycled = state_->readBuffers().acquire();
+    auto& buffer = *recycled;
+    struct Trim
+    {
+        beast::flat_buffer& buffer;
+        ~Trim()
+        {
+            buffer.clear();
+            if (buffer.capacity() > readBufferKept) buffer.shrink_to_fit();
+        }
+    } const trim{buffer};
+
+    while (hasConnection_) {
+        // Backpressure: take no more requests until the replies go out
+        if (control_.size() >= controlBacklog) {
+            co_await drained_.async_wait(redirect(ec));
+            continue;
+        }
+
+        buffer.clear();
+        co_await websocket_.async_read(buffer, redirect(ec));
+
         if (ec) {
+            // Closed by the client, or by the writer after an error
+            bool const wasConnected = hasConnection_;
             hasConnection_ = false;
-            return fail(ec, "websocket flush");
+            signal_.cancel();
+
+            if (ec == beast::websocket::error::closed || !wasConnected) {
+                co_return;
+            }
+            co_return fail(ec, "websocket read");
         }
 
-        // Remove what we just sent
-        tempQueue.pop();
+        ADAPTIV_DEBUG_CERR(this << ":" <<
+            beast::make_printable(buffer.data()));
+        handle(buffer);
     }
-
-    isFlushing_ = false;
-    ADAPTIV_DEBUG_CERR("<-flush(id:" << this << ')');
 }
 
-void WebSocketSession::run(boost::asio::yield_context yield)
+awaitable_t<error_code> WebSocketSession::sendNext()
 {
-    ADAPTIV_DEBUG_CERR("->run(id:" << this << ')');
-
+    auto const& options = state_->options();
     error_code ec;
 
-    // This buffer will hold the incoming message
-    beast::flat_buffer buffer;
-
-    // Only run a request if we're not busy
-    if (!state_->isBusy()) {
-        websocket_.async_read(buffer, yield[ec]);
-        ADAPTIV_DEBUG_CERR(this << ":" << beast::buffers_to_string(buffer.data()));
+    if (options.coalesceWindow.count() == 0) {
+        if (auto msg = next()) {
+            // Send the message (the reference keeps it alive meanwhile)
+            co_await websocket_.async_write(
+                net::buffer(msg->encoded(format_)), redirect(ec));
+            ++counters_.messages;
+            ++counters_.frames;
+        }
+        co_return isTooSlow_ ? net::error::no_buffer_space : ec;
     }
 
-    // This indicates that the session was closed
-    if (ec == beast::websocket::error::closed) {
-        hasConnection_ = false;
-        return;
+    // Gather messages until the latency or the size budget is spent
+    auto& batch = batch_;
+    batch.clear();
+    std::size_t bytes = 0;
+    signal_.expires_after(options.coalesceWindow);
+    while (true) {
+        while (bytes < options.coalesceBytes) {
+            auto msg = next();
+            if (!msg) break;
+            bytes += msg->encoded(format_).size();
+            batch.push_back(std::move(msg));
+        }
+
+        // Nothing else is coming if the solver has finished, and replies
+        // to the client must not wait for the window to close
+        if (bytes >= options.coalesceBytes || !state_->isBusy() ||
+            !control_.empty() || !hasConnection_) {
+            break;
+        }
+
+        // Woken up early (cancelled) by notify() when more messages arrive
+        co_await signal_.async_wait(redirect(ec));
+        if (!ec) break;
     }
+    signal_.expires_at(net::steady_timer::time_point::max());
+    ec = {};
+
+    if (isTooSlow_) co_return net::error::no_buffer_space;
+    if (batch.empty()) co_return ec;
+
+    auto& buffers = buffers_;
+    buffers.clear();
+    if (batch.size() == 1) {
+        co_await websocket_.async_write(
+            net::buffer(batch.front()->encoded(format_)), redirect(ec));
+    } else if (format_ == protocol::Format::binary) {
+        // Binary messages are self-delimiting: send them back to back
+        for (auto const& msg : batch) {
+            buffers.push_back(net::buffer(msg->encoded(format_)));
+        }
+
+        co_await websocket_.async_write(buffers, redirect(ec));
+    } else {
+        // A single frame with a JSON array of the messages: "[m1,m2,...]"
+        buffers.push_back(net::buffer("[", 1));
+        for (auto const& msg : batch) {
+            if (buffers.size() > 1) buffers.push_back(net::buffer(",", 1));
+            buffers.push_back(net::buffer(msg->encoded(format_)));
+        }
+        buffers.push_back(net::buffer("]", 1));
 
-    if (ec) {
-        hasConnection_ = false;
-        return fail(ec, "websocket run");
+        co_await websocket_.async_write(buffers, redirect(ec));
     }
 
-    // Process the request
-    if (!state_->isBusy()) {
-        auto command = beast::buffers_to_string(buffer.data());
-        if (command == "solve") {
-            state_->solve();
-            ADAPTIV_DEBUG_CERR("starting solver...");
+    counters_.messages += batch.size();
+    ++counters_.frames;
+
+    // Release the messages now (the pool recycles them), keep the memory
+    batch.clear();
+    co_return ec;
+}
+
+awaitable_t<> WebSocketSession::disconnect()
+{
+    ADAPTIV_DEBUG_CERR("disconnect(id:" << this << ", backlog:" <<
+        state_->broadcast().head() - cursor_ << ')');
+
+    // The websocket timeout bounds the wait for the close handshake
+    error_code ec;
+    co_await websocket_.async_close(
+        beast::websocket::close_reason(
+            beast::websocket::close_code::policy_error, "too slow"),
+        redirect(ec));
+}
+
+awaitable_t<> WebSocketSession::run()
+{
+    ADAPTIV_DEBUG_CERR("->run(id:" << this << ')');
+
+    net::co_spawn(websocket_.get_executor(),
+        [self = shared_from_this()]() -> awaitable_t<>
+        {
+            co_await self->read();
+        },
+        net::detached);
+
+    error_code ec;
+    std::size_t burst = 0; // Control frames sent in a row
+
+    while (hasConnection_) {
+        bool const hasControl = !control_.empty();
+
+        if (!hasControl && !hasPending()) {
+            // Sleep until notify() or reply() cancel the wait. Checking the
+            // lanes and starting the wait happen on the strand without
+            // suspending, so a notification cannot be lost in between
+            co_await signal_.async_wait(redirect(ec));
+            continue;
+        }
+
+        if (hasControl && (burst < controlBurst || !hasPending())) {
+            // Keep the message alive until the write completes
+            auto message = std::move(control_.front());
+            control_.pop_front();
+            ++burst;
+            if (control_.size() < controlBacklog) drained_.cancel();
+
+            co_await websocket_.async_write(net::buffer(message),
+                                            redirect(ec));
         } else {
-            message("{result:invalid}", yield);
+            burst = 0;
+            ec = co_await sendNext();
         }
-    }
 
-    // Busy: we can only update the client for now
-    while(state_->isBusy() || !queueEmpty()) {
-        if (!isFlushing_ && !queueEmpty()) {
-            // Only start flushing if previous writes have been completed
-            // and if there is actually something in the queue
-            flush(yield);
+        if (ec) {
+            if (!hasConnection_) break; // The reader saw the close first
 
-            // todo: use flush return value to break this loop
-            if (!hasConnection()) {
-                break;
-            }
+            hasConnection_ = false;
+            if (isTooSlow_) co_await disconnect();
+            fail(ec, "websocket write");
         }
     }
 
-//    // Push message to all queues
-//    auto message = beast::buffers_to_string(buffer.data());
-//    state_->push(message);
+    // Stop the reader, if the writer gave up first
+    beast::get_lowest_layer(websocket_).cancel();
+    drained_.cancel();
 
     ADAPTIV_DEBUG_CERR("<-run(id:" << this << ')');
 }
 
+void WebSocketSession::notify()
+{
+    // A pending wake-up has not run yet: the writer will see this one too
+    if (isNotified_.exchange(true, std::memory_order_acq_rel)) return;
+
+    net::post(websocket_.get_executor(),
+        [weak = weak_from_this()]
+        {
+            // The session may be gone by the time the wake-up runs
+            if (auto self = weak.lock()) {
+                self->isNotified_.exchange(false, std::memory_order_acq_rel);
+                self->signal_.cancel();
+            }
+        });
+}
+
+Options const& WebSocketSession::options() const noexcept
+{
+    return state_->options();
+}
+
 std::shared_ptr<WebSocketSession> WebSocketSession::makeShared(
-    net::ip::tcp::socket&& socket,
+    stream_t::socket_type&& socket,
     std::shared_ptr<SharedState> const& state)
 {
-    return std::make_shared<WebSocketSession>(std::move(socket), state);
+    auto session = std::make_shared<WebSocketSession>(std::move(socket), state);
+
+    // Only join once owned by a shared_ptr: the registry holds weak_ptrs
+    state->join(session);
+    return session;
 }
 
 ADAPTIV_SERVER_NAMESPACE_END